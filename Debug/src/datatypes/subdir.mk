@@ -6,16 +6,19 @@
 C_SRCS += \
 ../src/datatypes/calqueue.c \
 ../src/datatypes/list.c \
+../src/datatypes/multiqueue.c \
 ../src/datatypes/nonblocking_queue.c 
 
 OBJS += \
 ./src/datatypes/calqueue.o \
 ./src/datatypes/list.o \
+./src/datatypes/multiqueue.o \
 ./src/datatypes/nonblocking_queue.o 
 
 C_DEPS += \
 ./src/datatypes/calqueue.d \
 ./src/datatypes/list.d \
+./src/datatypes/multiqueue.d \
 ./src/datatypes/nonblocking_queue.d 
 
 
@@ -4,12 +4,18 @@
 
 # Add inputs and outputs from these tool invocations to the build variables 
 C_SRCS += \
+../src/mm/epoch.c \
+../src/mm/hazard.c \
 ../src/mm/myallocator.c 
 
 OBJS += \
+./src/mm/epoch.o \
+./src/mm/hazard.o \
 ./src/mm/myallocator.o 
 
 C_DEPS += \
+./src/mm/epoch.d \
+./src/mm/hazard.d \
 ./src/mm/myallocator.d 
 
 
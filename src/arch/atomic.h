@@ -50,6 +50,9 @@ typedef struct { volatile unsigned int lock; } spinlock_t;
 
 inline bool CAS_x86(volatile unsigned long long *ptr, unsigned long long oldVal, unsigned long long newVal);
 inline bool iCAS_x86(volatile unsigned int *ptr, unsigned int oldVal, unsigned int newVal);
+#if defined(ARCH_X86_64)
+inline bool CAS128_x86(volatile unsigned __int128 *ptr, unsigned __int128 oldVal, unsigned __int128 newVal);
+#endif
 inline int atomic_test_and_set_x86(int *);
 inline int atomic_test_and_reset_x86(int *);
 inline void atomic_add_x86(atomic_t *, int);
@@ -93,6 +93,35 @@ inline bool iCAS_x86(volatile unsigned int *ptr, unsigned int oldVal, unsigned i
 }
 
 
+#if defined(ARCH_X86_64)
+/**
+* This function implements a compare-and-swap atomic operation on x86-64 for 128-bit values.
+* The value has to be aligned to 16 bytes.
+*
+* @param ptr the address where to perform the CAS operation on
+* @param oldVal the old value we expect to find before swapping
+* @param newVal the new value to place in ptr if ptr contains oldVal
+*
+* @ret true if the CAS succeeded, false otherwise
+*/
+inline bool CAS128_x86(volatile unsigned __int128 *ptr, unsigned __int128 oldVal, unsigned __int128 newVal) {
+	bool res;
+	unsigned long long old_low = (unsigned long long) oldVal;
+	unsigned long long old_high = (unsigned long long) (oldVal >> 64);
+
+	__asm__ __volatile__(
+		LOCK "cmpxchg16b %1;"
+		"setz %0"
+		: "=q"(res), "+m"(*ptr), "+a"(old_low), "+d"(old_high)
+		: "b"((unsigned long long) newVal), "c"((unsigned long long) (newVal >> 64))
+		: "memory", "cc"
+	);
+
+	return res;
+}
+#endif
+
+
 /**
 * This function implements the atomic_test_and_set on an integer value, for x86-64 archs
 *
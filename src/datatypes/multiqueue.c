@@ -0,0 +1,240 @@
+/*****************************************************************************
+*
+*	This file is part of NBQueue, a lock-free O(1) priority queue.
+*
+*   Copyright (C) 2015, Romolo Marotta
+*
+*   This program is free software: you can redistribute it and/or modify
+*   it under the terms of the GNU General Public License as published by
+*   the Free Software Foundation, either version 3 of the License, or
+*   (at your option) any later version.
+*
+*   This is distributed in the hope that it will be useful,
+*   but WITHOUT ANY WARRANTY; without even the implied warranty of
+*   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+*   GNU General Public License for more details.
+*
+*   You should have received a copy of the GNU General Public License
+*   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*
+******************************************************************************/
+/*
+ * multiqueue.c
+ *
+ *  The dequeuers of a single nonblocking queue race on the same candidate.
+ *  Here they are spread on several sub-queues, at the price of a bounded rank error.
+ */
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+
+#include "../arch/atomic.h"
+#include "../mm/myallocator.h"
+#include "../datatypes/multiqueue.h"
+
+static volatile unsigned int rank_threads = 0;	// threads which own a rank counter
+static __thread unsigned int rank_slot = UINT_MAX;
+static __thread unsigned int rank_dequeues = 0;
+
+/**
+ * This function measures, once per period, the rank error of an event dequeued by the calling thread,
+ * namely the number of sub-queues whose minimum precedes it. Any of them holds at least
+ * one event which should have been dequeued before, thus the measure is a lower bound.
+ *
+ * @param mq the interested multiqueue
+ * @param timestamp the timestamp of the dequeued event
+ */
+static void sample_rank(multiqueue *mq, pkey_t timestamp)
+{
+	unsigned long long rank = 0;
+	unsigned int i, slot;
+
+	if(++rank_dequeues < MQ_RANK_PERIOD)
+		return;
+	rank_dequeues = 0;
+
+	if(rank_slot == UINT_MAX)
+	{
+		do
+			slot = rank_threads;
+		while(!iCAS_x86(&rank_threads, slot, slot+1));
+
+		if(slot >= QUEUE_MAX_THREADS)
+		{
+			printf("Too many threads measure the rank error\n");
+			exit(1);
+		}
+		rank_slot = slot;
+	}
+
+	for(i = 0; i < mq->count; i++)
+		rank += peek_min(mq->queues[i]) < timestamp;
+
+	mq->ranks[rank_slot].samples++;
+	mq->ranks[rank_slot].sum += rank;
+	if(rank > mq->ranks[rank_slot].max)
+		mq->ranks[rank_slot].max = rank;
+}
+
+/**
+ * This function allocates a multiqueue
+ *
+ * @param threads the number of threads which use the multiqueue
+ * @param factor the number of sub-queues for each thread
+ * @param queue_size the initial size of the hashtable of each sub-queue
+ * @param bucket_width the width of the buckets of each sub-queue
+ * @param collaborative_todo_list if the enqueuers of a sub-queue help its expansions
+ *
+ * @return the pointer to the new multiqueue
+ */
+multiqueue* multiqueue_init(unsigned int threads, unsigned int factor, unsigned int queue_size,
+		pkey_t bucket_width, unsigned int collaborative_todo_list)
+{
+	multiqueue *res;
+	unsigned int i;
+
+	res = (multiqueue*) mm_std_malloc(sizeof(multiqueue));
+	if(res == NULL)
+	{
+		printf("No enough memory to allocate multiqueue\n");
+		exit(1);
+	}
+
+	res->count = (threads * factor) > 0 ? threads * factor : 1;
+	res->queues = (nonblocking_queue**) mm_std_malloc(sizeof(nonblocking_queue*) * res->count);
+	res->ranks = (rank_counter*) mm_std_aligned_malloc(CACHE_LINE_SIZE, sizeof(rank_counter) * QUEUE_MAX_THREADS);
+	if(res->queues == NULL || res->ranks == NULL)
+	{
+		printf("No enough memory to allocate multiqueue\n");
+		exit(1);
+	}
+	memset(res->ranks, 0, sizeof(rank_counter) * QUEUE_MAX_THREADS);
+
+	for(i = 0; i < res->count; i++)
+		res->queues[i] = queue_init(queue_size, bucket_width, collaborative_todo_list);
+
+	return res;
+}
+
+/**
+ * This function enqueues an event in a random sub-queue
+ *
+ * @param mq the interested multiqueue
+ * @param timestamp the key associated with the value
+ * @param payload the event to be enqueued
+ *
+ * @return true if the event is inserted in the hashtable of the sub-queue, else false
+ */
+bool multiqueue_enqueue(multiqueue *mq, pkey_t timestamp, void *payload)
+{
+	return enqueue(mq->queues[queue_random() % mq->count], timestamp, payload);
+}
+
+/**
+ * This function dequeues the minimum of the better of two random sub-queues.
+ * They are compared by peek_lower_bound, which costs a read of current, while
+ * peek_min would scan the empty buckets of sparse sub-queues at each dequeue.
+ * If the chosen one is found empty, the sub-queues whose size counters are not zero
+ * are tried in turn before the multiqueue is reported empty.
+ *
+ * @param mq the interested multiqueue
+ * @param entry used to return timestamp, counter and payload of the dequeued event
+ *
+ * @return QUEUE_OK if an event has been dequeued, QUEUE_EMPTY if the multiqueue is empty
+ */
+int multiqueue_dequeue(multiqueue *mq, queue_entry *entry)
+{
+	unsigned int i, j, start;
+
+	i = queue_random() % mq->count;
+	j = queue_random() % mq->count;
+	if(peek_lower_bound(mq->queues[j]) < peek_lower_bound(mq->queues[i]))
+		i = j;
+
+	if(dequeue_entry(mq->queues[i], entry) == QUEUE_OK)
+	{
+		sample_rank(mq, entry->timestamp);
+		return QUEUE_OK;
+	}
+
+	// the counters tell the empty sub-queues apart without scanning their buckets
+	start = queue_random();
+	for(i = 0; i < mq->count; i++)
+	{
+		j = (start + i) % mq->count;
+		if(!is_empty(mq->queues[j]) && dequeue_entry(mq->queues[j], entry) == QUEUE_OK)
+		{
+			sample_rank(mq, entry->timestamp);
+			return QUEUE_OK;
+		}
+	}
+
+	return QUEUE_EMPTY;
+}
+
+/**
+ * This function frees the nodes of the sub-queues below a threshold. The events dequeued from
+ * the other sub-queues tell nothing about the ones left in a sub-queue, thus each one is pruned
+ * no further than its own lower bound.
+ *
+ * @param mq the interested multiqueue
+ * @param timestamp the threshold computed by the application, as for prune
+ */
+void multiqueue_prune(multiqueue *mq, pkey_t timestamp)
+{
+	pkey_t bound;
+	unsigned int i;
+
+	for(i = 0; i < mq->count; i++)
+	{
+		bound = peek_lower_bound(mq->queues[i]);
+		prune(mq->queues[i], timestamp < bound ? timestamp : bound);
+	}
+}
+
+/**
+ * This function estimates the number of events in a multiqueue
+ *
+ * @param mq the interested multiqueue
+ *
+ * @return the sum of the sizes of the sub-queues
+ */
+unsigned long long multiqueue_size(multiqueue *mq)
+{
+	unsigned long long res = 0;
+	unsigned int i;
+
+	for(i = 0; i < mq->count; i++)
+		res += size_estimate(mq->queues[i]);
+
+	return res;
+}
+
+/**
+ * This function returns the rank error measured by the threads on the dequeued events
+ *
+ * @param mq the interested multiqueue
+ * @param max used to return the largest measured rank error, if not NULL
+ *
+ * @return the average measured rank error, 0 if no dequeue has been measured
+ */
+double multiqueue_rank_error(multiqueue *mq, unsigned long long *max)
+{
+	unsigned long long samples = 0, sum = 0, res_max = 0;
+	unsigned int i;
+
+	for(i = 0; i < QUEUE_MAX_THREADS; i++)
+	{
+		samples += mq->ranks[i].samples;
+		sum += mq->ranks[i].sum;
+		if(mq->ranks[i].max > res_max)
+			res_max = mq->ranks[i].max;
+	}
+
+	if(max != NULL)
+		*max = res_max;
+	return samples == 0 ? 0.0 : (double) sum / (double) samples;
+}
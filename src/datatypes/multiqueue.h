@@ -0,0 +1,60 @@
+/*****************************************************************************
+*
+*	This file is part of NBQueue, a lock-free O(1) priority queue.
+*
+*   Copyright (C) 2015, Romolo Marotta
+*
+*   This program is free software: you can redistribute it and/or modify
+*   it under the terms of the GNU General Public License as published by
+*   the Free Software Foundation, either version 3 of the License, or
+*   (at your option) any later version.
+*
+*   This is distributed in the hope that it will be useful,
+*   but WITHOUT ANY WARRANTY; without even the implied warranty of
+*   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+*   GNU General Public License for more details.
+*
+*   You should have received a copy of the GNU General Public License
+*   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*
+******************************************************************************/
+/*
+ * multiqueue.h
+ *
+ *  A relaxed priority queue made of several nonblocking queues: events are enqueued
+ *  in a random sub-queue and dequeued from the better of two random ones.
+ */
+#ifndef DATATYPES_MULTIQUEUE_H_
+#define DATATYPES_MULTIQUEUE_H_
+
+#include "nonblocking_queue.h"
+
+#ifndef MQ_FACTOR
+#define MQ_FACTOR		2		// Sub-queues for each thread, the rank error grows with it
+#endif
+
+#ifndef MQ_RANK_PERIOD
+#define MQ_RANK_PERIOD	64		// Dequeues of a thread between two measures of the rank error
+#endif
+
+/**
+ *
+ */
+typedef struct multiqueue multiqueue;
+struct multiqueue
+{
+	unsigned int count;				// number of sub-queues
+	nonblocking_queue **queues;
+	rank_counter *ranks;			// one for each thread
+};
+
+
+extern multiqueue* multiqueue_init(unsigned int threads, unsigned int factor, unsigned int queue_size,
+		pkey_t bucket_width, unsigned int collaborative_todo_list);
+extern bool multiqueue_enqueue(multiqueue *mq, pkey_t timestamp, void *payload);
+extern int multiqueue_dequeue(multiqueue *mq, queue_entry *entry);
+extern void multiqueue_prune(multiqueue *mq, pkey_t timestamp);
+extern unsigned long long multiqueue_size(multiqueue *mq);
+extern double multiqueue_rank_error(multiqueue *mq, unsigned long long *max);
+
+#endif /* DATATYPES_MULTIQUEUE_H_ */
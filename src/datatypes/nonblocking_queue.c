@@ -39,6 +39,60 @@
 #include "../mm/myallocator.h"
 #include "../datatypes/nonblocking_queue.h"
 
+// nodes provided by the caller are given back through the release function of the queue
+#define release_function(queue, node)\
+		( ((node)->flags & NODE_INTRUSIVE) ? (queue)->release :\
+		  ((node)->flags & NODE_SENTINEL)  ? mm_std_free : mm_free )
+
+/// Counts a retirement of a node, so that the handles taken before no longer match it
+#define next_generation(node)			((node)->flags += NODE_GENERATION)
+
+#define release_node(queue, node)\
+		do { next_generation(node); release_function((queue), (node))(node); } while(0)
+
+#if RECLAMATION == RECLAMATION_EPOCH
+#include "../mm/epoch.h"
+
+#define critical_enter()				epoch_enter()
+#define critical_exit()					epoch_exit()
+#define retire_node(queue, node)\
+		do { next_generation(node); epoch_retire((node), release_function((queue), (node))); } while(0)
+#define protect(slot, pointer)
+#define protected_read(slot, field)		(field)
+#elif RECLAMATION == RECLAMATION_HAZARD
+#include "../mm/hazard.h"
+
+// Hazard pointers used by the queue
+#define HP_LEFT		0	// left node of a search
+#define HP_RIGHT	1	// right node of a search, candidate of a dequeue
+#define HP_FUTURE	2	// head of the future list
+#define HP_TODO		3	// head of the todo list
+#define HP_NEXT		4	// node met by a walk, alternated with HP_RIGHT
+#define HP_SEGMENT	5	// heads of the segment of the bucket in use
+
+#define critical_enter()
+#define critical_exit()					hazard_clear_all()
+#define retire_node(queue, node)\
+		do { next_generation(node); hazard_retire((node), release_function((queue), (node))); } while(0)
+#define protect(slot, pointer)			hazard_protect((slot), (pointer))
+#define protected_read(slot, field)\
+		({\
+			bucket_node *__p;\
+			do\
+			{\
+				__p = (field);\
+				hazard_protect((slot), __p);\
+			}\
+			while(__p != (field));\
+			__p;\
+		})
+#else
+#define critical_enter()
+#define critical_exit()
+#define protect(slot, pointer)
+#define protected_read(slot, field)		(field)
+#endif
+
 __thread bucket_node *to_free_pointers = NULL;
 __thread unsigned int  lid;
 __thread unsigned int  mark;
@@ -50,25 +104,29 @@ __thread unsigned int  mark;
 
 /**
  * This function calls a machine instruction that in O(1) finds the first set bit
- * of a 32bit value (Bit Scan Reverse)
+ * of an index (Bit Scan Reverse)
  *
  * @author Romolo Marotta
  *
  * @param value
  *
  */
-static inline unsigned int ibsr_x86(unsigned int value)
+static inline unsigned int ibsr_x86(index_t value)
 {
-	unsigned int res = 0;
+	index_t res = 0;
 
 	__asm__ __volatile__(
+#if BUCKET_INDEX == INDEX_64
+			"bsrq %1, %0;"
+#else
 			"bsrl %1, %0;"
+#endif
 			: "=r"(res)
 			: "r"(value)
 			: "cc"
 	);
 
-	return res & (-(value != 0));
+	return (unsigned int) res & (-(value != 0));
 }
 
 /**
@@ -83,7 +141,7 @@ static inline unsigned int ibsr_x86(unsigned int value)
  *  @return the first-level index
  */
 #if USE_MACRO == 0
-static inline unsigned int firstIndex(unsigned int index, unsigned int init_size)
+static inline unsigned int firstIndex(index_t index, unsigned int init_size)
 {
 
 	return ( (ibsr_x86(index) - ibsr_x86(init_size) + 1) & -( (index) >= (init_size) ) );
@@ -111,7 +169,7 @@ static inline unsigned int firstIndex(unsigned int index, unsigned int init_size
  *  @return the bucket in the given queue corresponding to the index
  */
 #if USE_MACRO == 0
-static inline char* access_hashtable(volatile void *hashtable, unsigned int index,
+static inline char* access_hashtable(volatile void *hashtable, index_t index,
 		unsigned int init_size, unsigned int item_size)
 {
 	char **h = (char**) hashtable;
@@ -119,7 +177,7 @@ static inline char* access_hashtable(volatile void *hashtable, unsigned int inde
 	unsigned int findex = indbit - ibsr_x86(init_size) + 1;
 	unsigned int check0 = (index >= init_size);
 	findex &= -check0;
-	return h[findex]+ (index & ((unsigned int)~(check0 << indbit)))*item_size;
+	return h[findex]+ (index & ((index_t)~((index_t) check0 << indbit)))*item_size;
 }
 #else
 #define access_hashtable(hashtable, index, init_size, item_size)\
@@ -130,11 +188,31 @@ static inline char* access_hashtable(volatile void *hashtable, unsigned int inde
 			unsigned int indbit = ibsr_x86(index);\
 			unsigned int findex = indbit - ibsr_x86(init_size) + 1;\
 			findex &= -check0;\
-			res = h[findex]+ ( (index) & ((unsigned int)~(check0 << indbit)))*(item_size);\
+			res = h[findex]+ ( (index) & ((index_t)~((index_t) check0 << indbit)))*(item_size);\
 			res;\
 		})
 #endif
 
+#if KEY_TYPE == KEY_TICKS
+/**
+ * This function computes the index of the destination bucket in the hashtable
+ * for integer keys, whose bucket width is a power of two
+ *
+ * @param timestamp the value to be hashed
+ * @param bucket_shift the log2 of the depth of a bucket
+ *
+ * @return the linear index of a given timestamp
+ */
+#if USE_MACRO == 0
+static inline index_t hash(pkey_t timestamp, unsigned int bucket_shift)
+{
+	return ((index_t) (timestamp >> bucket_shift));
+}
+#else
+#define hash(timestamp, bucket_shift)\
+		((index_t) ( (timestamp) >> (bucket_shift) ))
+#endif
+#else
 /**
  * This function computes the index of the destination bucket in the hashtable
  *
@@ -146,13 +224,152 @@ static inline char* access_hashtable(volatile void *hashtable, unsigned int inde
  * @return the linear index of a given timestamp
  */
 #if USE_MACRO == 0
-static inline unsigned int hash(double timestamp, double bucket_width)
+static inline index_t hash(double timestamp, double bucket_width)
 {
-	return ((unsigned int) (timestamp / bucket_width));
+	return ((index_t) (timestamp / bucket_width));
 }
 #else
 #define hash(timestamp, bucket_width)\
-		((unsigned int) ( (timestamp) / (bucket_width) ))
+		((index_t) ( (timestamp) / (bucket_width) ))
+#endif
+#endif
+
+/**
+ * This function computes the first linear index of a segment of the hashtable
+ *
+ * @param segment the first-level index
+ * @param init_size the initial size of the hashtable
+ *
+ * @return the linear index of the first bucket in the segment
+ */
+static inline index_t segment_base(unsigned int segment, unsigned int init_size)
+{
+	return segment == 0 ? 0 : (index_t) init_size << (segment - 1);
+}
+
+#if ADAPTIVE_WIDTH == ADAPTIVE_WIDTH_ON
+/**
+ * This function computes the index of the destination bucket in the hashtable,
+ * looking up the segment which covers the timestamp. Segments are appended
+ * with increasing timestamps, thus the lookup usually stops at the last one.
+ *
+ * @param queue
+ * @param timestamp the value to be hashed
+ *
+ * @return the linear index of a given timestamp
+ */
+static inline index_t bucket_index(nonblocking_queue *queue, double timestamp)
+{
+	unsigned int segment = queue->segments - 1;
+
+	while(segment != 0 && timestamp < queue->starts[segment])
+		segment--;
+
+	return segment_base(segment, queue->init_size)
+			+ hash(timestamp - queue->starts[segment], queue->widths[segment]);
+}
+
+/**
+ * This function computes the first timestamp covered by a bucket
+ *
+ * @param queue
+ * @param index the linear index of a bucket whose segment has a width
+ *
+ * @return the lower bound of the timestamps in the bucket
+ */
+static inline double bucket_start(nonblocking_queue *queue, index_t index)
+{
+	unsigned int segment = firstIndex(index, queue->init_size);
+
+	return queue->starts[segment]
+			+ (double) (index - segment_base(segment, queue->init_size)) * queue->widths[segment];
+}
+#elif KEY_TYPE == KEY_TICKS
+#define bucket_index(queue, timestamp)	hash((timestamp), (queue)->bucket_shift)
+#define bucket_start(queue, index)		((pkey_t) (index) << (queue)->bucket_shift)
+#else
+#define bucket_index(queue, timestamp)	hash((timestamp), (queue)->bucket_width)
+#define bucket_start(queue, index)		((double) (index) * (queue)->bucket_width)
+#endif
+
+#if CALENDAR == CALENDAR_RING
+/// Returns the head of the bucket with a given index: the window is reused lap after lap
+#define bucket_head_of(queue, index)\
+		((bucket_node*) &(queue)->hashtable[0][(index) & ((queue)->init_size - 1)])
+
+/// The window of the ring is never retired
+#define first_bucket_in_use(queue, index)	(index)
+
+/// Moves an index which precedes the window ending at a given index into the first bucket of the window
+#define window_index(queue, index, end)\
+		( (index) + (queue)->init_size < (end) ? (end) - (queue)->init_size : (index) )
+
+/// Tells whether a node found in the bucket of a given index belongs to a later lap
+#define later_lap(queue, node, index)	(bucket_index((queue), (node)->timestamp) > (index))
+
+/// Returns the end of the window that follows the one ending at a given index
+#define next_size(queue, size)			((size) + (queue)->init_size)
+#else
+#define segment_head_of(queue, index)\
+		((bucket_node*) access_hashtable((queue)->hashtable, (index), (queue)->init_size, sizeof(bucket_head)))
+
+/**
+ * This function returns the first bucket from a given one which is not in a segment
+ * retired by prune. The buckets of a retired segment are before the watermark and hold
+ * no event but the late ones which prune moves, thus the first bucket of the next segment
+ * in use stands for them.
+ *
+ * @param queue
+ * @param index the linear index of a bucket
+ *
+ * @return the linear index of the first bucket in use which does not precede the given one
+ */
+static inline index_t first_bucket_in_use(nonblocking_queue *queue, index_t index)
+{
+	unsigned int segment;
+
+	// the segments are retired only once the watermark is past them
+	if(index >= queue->starting_slot)
+		return index;
+
+	segment = firstIndex(index, queue->init_size);
+	while(queue->hashtable[segment] == SEGMENT_RETIRED)
+		index = segment_base(++segment, queue->init_size);
+
+	return index;
+}
+
+/**
+ * This function returns the head of the bucket with a given index, or of the first bucket
+ * in use after it. With hazard pointers the segment is protected, so that prune does not
+ * free it while the head is in use.
+ *
+ * @param queue
+ * @param index the linear index of the bucket
+ *
+ * @return the head of the bucket
+ */
+static inline bucket_node* bucket_head_of(nonblocking_queue *queue, index_t index)
+{
+	unsigned int segment;
+	bucket_head *heads;
+
+	do
+	{
+		index = first_bucket_in_use(queue, index);
+		segment = firstIndex(index, queue->init_size);
+		heads = queue->hashtable[segment];
+		protect(HP_SEGMENT, heads);
+	}
+	// the segment may be retired after the watermark is read
+	while(heads == SEGMENT_RETIRED || heads != queue->hashtable[segment]);
+
+	return (bucket_node*) &heads[index - segment_base(segment, queue->init_size)];
+}
+
+#define window_index(queue, index, end)	(index)
+#define later_lap(queue, node, index)	((void) (index), false)
+#define next_size(queue, size)			((size) * 2)
 #endif
 
 /**
@@ -243,6 +460,55 @@ static inline unsigned long long generate_mark() {
 	 })
 #endif
 
+#if BUCKET_INDEX == INDEX_64
+typedef unsigned __int128 current_t;
+#define CURRENT_SHIFT	64
+#define CAS_current(queue, old_value, new_value)\
+		CAS128_x86(&(queue)->current, (old_value), (new_value))
+#define CAS_size(pointer, old_value, new_value)\
+		CAS_x86((pointer), (old_value), (new_value))
+/// True if current still holds a value, compared at once since a plain read takes two loads
+#define same_current(queue, value)	CAS_current(queue, value, value)
+#else
+typedef unsigned long long current_t;
+#define CURRENT_SHIFT	32
+#define CAS_current(queue, old_value, new_value)\
+		CAS_x86(&(queue)->current, (old_value), (new_value))
+#define CAS_size(pointer, old_value, new_value)\
+		iCAS_x86((pointer), (old_value), (new_value))
+#define same_current(queue, value)	((queue)->current == (value))
+#endif
+
+/// Returns the bucket index kept in a value of current
+#define current_index(value)	((index_t) ((value) >> CURRENT_SHIFT))
+
+/// Returns a new value of current referring to a given bucket
+#define new_current(index)		( ( ( (current_t) (index) ) << CURRENT_SHIFT ) | generate_mark() )
+
+/**
+ * This function returns a snapshot of current. With 64-bit indices, the two halves of
+ * a plain read may come from different updates, thus the read is confirmed by a CAS
+ * which leaves current unchanged.
+ *
+ * @param queue the interested queue
+ *
+ * @return the value of current
+ */
+#if BUCKET_INDEX == INDEX_64
+static inline current_t read_current(nonblocking_queue *queue)
+{
+	current_t value;
+
+	do
+		value = queue->current;
+	while(!same_current(queue, value));
+
+	return value;
+}
+#else
+#define read_current(queue)	((queue)->current)
+#endif
+
 /**
  * This function blocks the execution of the process.
  * Used for debug purposes.
@@ -260,9 +526,11 @@ static void error(const char *msg, ...) {
 	exit(1);
 }
 
+#if RECLAMATION == RECLAMATION_PRUNE
 /**
  * This function connect to a private structure marked
- * nodes in order to free them later, during a synchronisation point
+ * nodes in order to free them later, during a synchronisation point.
+ * The payload and counter of the first node are overwritten with the links of the structure.
  *
  * @author Romolo Marotta
  *
@@ -286,10 +554,33 @@ static inline void connect_to_be_freed_list(nonblocking_queue *queue, bucket_nod
 {\
 	(start)->payload = to_free_pointers;\
 	/*(start)->queue   = (queue);*/\
+	(void) (queue);\
 	(start)->counter = (counterm);\
 	to_free_pointers = (start);\
 }
 #endif
+#else
+/**
+ * This function hands a disconnected sequence of marked nodes to the
+ * reclamation scheme, which frees them once no thread can reach them
+ *
+ * @param queue used to associate freed nodes to a queue
+ * @param start the pointer to the first node in the disconnected sequence
+ * @param counter the number of nodes in the disconnected sequence
+ *
+ */
+static inline void connect_to_be_freed_list(nonblocking_queue *queue, bucket_node *start, unsigned int counter)
+{
+	bucket_node *next;
+
+	while(counter-- != 0)
+	{
+		next = get_unmarked(start->next);
+		retire_node(queue, start);
+		start = next;
+	}
+}
+#endif
 
 
 /**
@@ -300,11 +591,11 @@ static inline void connect_to_be_freed_list(nonblocking_queue *queue, bucket_nod
  *  @param payload is a pointer to the referred payload by the node
  *  @param timestamp the timestamp associated to the payload
  *
- *  @return the pointer to the allocated node
+ *  @return the pointer to the allocated node, which keeps the generation it had when it was freed
  *
  */
 #if USE_MACRO == 0
-static inline bucket_node* node_malloc(void *payload, double timestamp)
+static inline bucket_node* node_malloc(void *payload, pkey_t timestamp)
 {
 
 	bucket_node* res = (bucket_node*) mm_malloc();
@@ -313,6 +604,7 @@ static inline bucket_node* node_malloc(void *payload, double timestamp)
 		error("%lu - Not aligned Node \n", pthread_self());
 
 	res->counter = 1;
+	res->flags &= ~NODE_KIND;
 	res->next = NULL;
 	res->payload = payload;
 	res->timestamp = timestamp;
@@ -326,6 +618,7 @@ static inline bucket_node* node_malloc(void *payload, double timestamp)
 	/*if (is_marked(res))\
 		error("%lu - Not aligned Node \n", pthread_self());*/\
 	res->counter = 1;\
+	res->flags &= ~NODE_KIND;\
 	res->next = NULL;\
 	res->payload = (n_payload);\
 	res->timestamp = (n_timestamp);\
@@ -334,6 +627,101 @@ static inline bucket_node* node_malloc(void *payload, double timestamp)
 #endif
 
 
+/**
+ *  This function allocates a sentinel node, namely the tail and the heads of the future and todo lists.
+ *  Sentinels are written by many threads, thus with NODE_PADDING_SENTINELS each of them
+ *  gets its own cache line.
+ *
+ *  @return the pointer to the allocated node
+ */
+#if KEY_TYPE == KEY_TICKS
+#define SENTINEL_KEY	INFTY
+#else
+#define SENTINEL_KEY	-4.0
+#endif
+
+static bucket_node* sentinel_malloc(void)
+{
+#if NODE_PADDING == NODE_PADDING_SENTINELS
+	bucket_node *res = (bucket_node*) mm_std_aligned_malloc(CACHE_LINE_SIZE, CACHE_LINE_SIZE);
+
+	if(res == NULL)
+		error("No enough memory to allocate a sentinel\n");
+
+	memset(res, 0, CACHE_LINE_SIZE);
+	res->flags = NODE_SENTINEL;
+	res->timestamp = SENTINEL_KEY;
+	return res;
+#else
+	return node_malloc(NULL, SENTINEL_KEY);
+#endif
+}
+
+#if RECLAMATION == RECLAMATION_HAZARD
+/**
+ * This function implements the search of a node that contains a given timestamp t. It finds two adjacent nodes,
+ * left and right, such that: left.timestamp <= t and right.timestamp > t.
+ * The left and right nodes are protected by hazard pointers when the function returns.
+ *
+ * Differently from the version by Harris, a marked node is disconnected as soon as it is met,
+ * since a sequence of marked nodes cannot be traversed safely with hazard pointers.
+ *
+ * Based on the code by Maged M. Michael. For further information see:
+ * Maged M. Michael, "High Performance Dynamic Lock-Free Hash Tables and List-Based Sets"
+ * Proceedings of the 14th ACM Symposium on Parallel Algorithms and Architectures, 2002
+ *
+ * @param queue the queue that contains the bucket
+ * @param head the head of the list in which we have to perform the search
+ * @param timestamp the value to be found
+ * @param left_node a pointer to a pointer used to return the left node
+ * @param right_node a pointer to a pointer used to return the right node
+ *
+ */
+static void search(nonblocking_queue* queue, bucket_node *head, pkey_t timestamp,
+		bucket_node **left_node, bucket_node **right_node)
+{
+	bucket_node *left, *right, *right_next, *tail;
+	tail = queue->tail;
+
+try_again:
+	// heads are never freed, thus they need no protection
+	left = head;
+	right = head->next;
+
+	while (right != tail)
+	{
+		protect(HP_RIGHT, right);
+		// the right node is reachable only if the left one still points to it
+		if (left->next != right)
+			goto try_again;
+
+		right_next = right->next;
+		if (is_marked(right_next))
+		{
+			if (!CAS_x86(
+						(volatile unsigned long long *)&(left->next),
+						(unsigned long long) right,
+						(unsigned long long) get_unmarked(right_next)
+						)
+					)
+				goto try_again;
+			retire_node(queue, right);
+			right = get_unmarked(right_next);
+			continue;
+		}
+
+		if (!(right->timestamp < timestamp || D_EQUAL(right->timestamp, timestamp)))
+			break;
+
+		left = right;
+		protect(HP_LEFT, left);
+		right = right_next;
+	}
+
+	*left_node = left;
+	*right_node = right;
+}
+#else
 /**
  * This function implements the search of a node that contains a given timestamp t. It finds two adjacent nodes,
  * left and right, such that: left.timestamp <= t and right.timestamp > t.
@@ -351,7 +739,7 @@ static inline bucket_node* node_malloc(void *payload, double timestamp)
  * @param right_node a pointer to a pointer used to return the right node
  *
  */
-static void search(nonblocking_queue* queue, bucket_node *head, double timestamp,
+static void search(nonblocking_queue* queue, bucket_node *head, pkey_t timestamp,
 		bucket_node **left_node, bucket_node **right_node)
 {
 	bucket_node *left, *right, *left_next, *tmp, *tmp_next, *tail;
@@ -416,6 +804,168 @@ static void search(nonblocking_queue* queue, bucket_node *head, double timestamp
 		}
 	} while (1);
 }
+#endif
+
+static volatile unsigned int size_threads = 0;	// threads which own a size counter
+__thread unsigned int size_slot = UINT_MAX;
+
+/**
+ * This function adds a number of events to the share of the size kept by the calling thread.
+ * Each counter has a single writer, thus it is updated without atomic instructions.
+ * The slot of a thread is taken at its first call and it is the same for any queue.
+ *
+ * @param queue the interested queue
+ * @param n the number of events enqueued, negative if they are dequeued
+ */
+static inline void count_events(nonblocking_queue *queue, long long n)
+{
+	unsigned int slot;
+
+	if(size_slot == UINT_MAX)
+	{
+		do
+			slot = size_threads;
+		while(!iCAS_x86(&size_threads, slot, slot+1));
+
+		if(slot >= QUEUE_MAX_THREADS)
+			error("Too many threads update the size of the queues\n");
+		size_slot = slot;
+	}
+
+	queue->sizes[size_slot].count += n;
+}
+
+static __thread unsigned int random_seed = 0;
+
+/**
+ * This function returns a pseudo-random number from the xorshift sequence of the calling thread
+ *
+ * @return the next number of the sequence
+ */
+unsigned int queue_random(void)
+{
+	unsigned int x = random_seed;
+
+	// each thread starts from its own id, zero would be a fixed point
+	if(x == 0)
+		x = 2463534242U + lid;
+
+	x ^= x << 13;
+	x ^= x >> 17;
+	x ^= x << 5;
+	random_seed = x;
+	return x;
+}
+
+/**
+ * This function accounts the rank error of a relaxed dequeue in the counter of the calling thread,
+ * which already owns a slot since it has dequeued
+ *
+ * @param queue the interested queue
+ * @param rank the number of live events which preceded the dequeued one
+ */
+static inline void count_rank(nonblocking_queue *queue, unsigned long long rank)
+{
+	rank_counter *counter = &queue->ranks[size_slot];
+
+	counter->samples++;
+	counter->sum += rank;
+	if(rank > counter->max)
+		counter->max = rank;
+}
+
+#if ELIMINATION == ELIMINATION_ON
+/**
+ * This function hands an event to a dequeuer waiting in the elimination array for one which
+ * precedes the minimum it failed to claim, thus the event never reaches the buckets.
+ * Only the events falling at or before the bucket of current look for a dequeuer.
+ *
+ * @param queue the interested queue
+ * @param timestamp the key associated with the value
+ * @param payload the event to be enqueued
+ *
+ * @return true if a dequeuer took the event, false if it has to be enqueued
+ */
+static bool eliminate_enqueue(nonblocking_queue *queue, pkey_t timestamp, void *payload)
+{
+	elimination_slot *slot;
+	unsigned long long state;
+	unsigned int i, start;
+
+	if(bucket_index(queue, timestamp) > current_index(queue->current))
+		return false;
+
+	start = queue_random();
+	for(i = 0; i < ELIMINATION_SLOTS; i++)
+	{
+		slot = &queue->elimination[(start + i) % ELIMINATION_SLOTS];
+		state = slot->state;
+		if((state & SLOT_STATE) != SLOT_WAITING || !(timestamp < slot->bound))
+			continue;
+
+		// the number of the offer is unchanged, thus the bound read belongs to it
+		if(!CAS_x86(&slot->state, state, state - SLOT_WAITING + SLOT_BUSY))
+			continue;
+
+		slot->timestamp = timestamp;
+		slot->payload = payload;
+		slot->state = state - SLOT_WAITING + SLOT_FILLED;
+		return true;
+	}
+
+	return false;
+}
+
+/**
+ * This function waits in a random slot of the elimination array for an enqueuer
+ * of an event preceding a bound, and withdraws the offer if none comes in time.
+ *
+ * @param queue the interested queue
+ * @param bound the timestamp of the minimum that the caller failed to claim
+ * @param entry used to return timestamp, counter and payload of the event handed over
+ *
+ * @return true if an event is handed over, false if the caller has to go back to the buckets
+ */
+static bool eliminate_dequeue(nonblocking_queue *queue, pkey_t bound, queue_entry *entry)
+{
+	elimination_slot *slot = &queue->elimination[queue_random() % ELIMINATION_SLOTS];
+	unsigned long long state, offer;
+	unsigned int i;
+
+	state = slot->state;
+	if((state & SLOT_STATE) != SLOT_FREE)
+		return false;
+
+	// a new number for each offer, so that a late enqueuer cannot fill a withdrawn one
+	offer = state - SLOT_FREE + (SLOT_STATE + 1);
+	if(!CAS_x86(&slot->state, state, offer + SLOT_BUSY))
+		return false;
+	slot->bound = bound;
+	slot->state = offer + SLOT_WAITING;
+
+	for(i = 0; i < ELIMINATION_SPINS && slot->state == offer + SLOT_WAITING; i++);
+
+	// an enqueuer may be filling the slot, thus the offer is withdrawn only while it is waiting
+	while(true)
+	{
+		state = slot->state;
+		if(state == offer + SLOT_WAITING && CAS_x86(&slot->state, state, offer + SLOT_FREE))
+			return false;
+		if(state == offer + SLOT_FILLED)
+			break;
+	}
+
+	entry->timestamp = slot->timestamp;
+	entry->counter = 1;
+	entry->payload = slot->payload;
+	slot->state = offer + SLOT_FREE;
+
+	// the event never entered the queue, thus only the handover is counted
+	count_events(queue, 0);
+	queue->sizes[size_slot].eliminated++;
+	return true;
+}
+#endif
 
 /**
  * This function commits a value in the current field of a queue. It retries until the timestamp
@@ -427,12 +977,11 @@ static void search(nonblocking_queue* queue, bucket_node *head, double timestamp
  * @param left_node the candidate node for being next current
  *
  */
-static inline void flush_current(nonblocking_queue* queue, unsigned int index)
+static inline void flush_current(nonblocking_queue* queue, index_t index)
 {
-	unsigned long long oldCur;
-	unsigned int oldIndex;
-	unsigned long long newCur =  ( ( unsigned long long ) index ) << 32;
-	newCur |= generate_mark();
+	current_t oldCur;
+	index_t oldIndex;
+	current_t newCur = new_current(index);
 
 	// Retry until the left node has a timestamp strictly less than current and
 	// the CAS fails
@@ -440,18 +989,42 @@ static inline void flush_current(nonblocking_queue* queue, unsigned int index)
 	{
 
 		oldCur = queue->current;
-		oldIndex = (unsigned int) (oldCur >> 32);
+		oldIndex = current_index(oldCur);
 	}
 	while (
 			index <= oldIndex
-			&& !CAS_x86(
-						(volatile unsigned long long *)&(queue->current),
-						(unsigned long long) oldCur,
-						(unsigned long long) newCur
-						)
+			&& !CAS_current(queue, oldCur, newCur)
 					);
 }
 
+/**
+ * This function sets the successor of a node which is not reachable from the buckets.
+ * A node moved from the todo list can be cancelled at the same time, thus its successor
+ * is written with a CAS and a mark is never overwritten. A new node has no handle yet.
+ *
+ * @param node the node being linked
+ * @param next the new successor
+ * @param moved true if the node comes from the todo list
+ *
+ * @return false if the node has been cancelled
+ */
+static inline bool set_next(bucket_node *node, bucket_node *next, bool moved)
+{
+	bucket_node *old = node->next;
+
+	if(!moved)
+	{
+		node->next = next;
+		return true;
+	}
+
+	return !is_marked(old) && CAS_x86(
+			(volatile unsigned long long *)&(node->next),
+			(unsigned long long) old,
+			(unsigned long long) next
+			);
+}
+
 /**
  * This function insert a new event in the nonblocking queue.
  * The cost of this operation when succeeds should be O(1) as calendar queue
@@ -461,13 +1034,16 @@ static inline void flush_current(nonblocking_queue* queue, unsigned int index)
  * @param queue the interested queue
  * @param timestamp the timestamp of the event
  * @param payload the event to be enqueued
+ * @param moved true if the node comes from the todo list, thus it may be cancelled concurrently
+ * @param linked used to return the index of the bucket in which the node is linked
  *
+ * @return true if the event is inserted in the hashtable, else false
  */
-static bool insert(nonblocking_queue* queue, bucket_node* new_node)
+static bool insert(nonblocking_queue* queue, bucket_node* new_node, bool moved, index_t *linked)
 {
 	bucket_node *left_node, *right_node, *tmp_node, *tmp, *bucket;
-	unsigned int index;
-	unsigned int tmp_size;
+	index_t index;
+	index_t tmp_size;
 	bool cas_result = false;
 
 	// Phase 1. Check if the hashtable cover the timestamp value. If not add the event in future list
@@ -477,14 +1053,19 @@ static bool insert(nonblocking_queue* queue, bucket_node* new_node)
 		// that an expansion of the hashtable is occurring
 		do
 		{
-			tmp_node = queue->future_list;
-			tmp_size = tmp_node->counter;
+			tmp_node = protected_read(HP_FUTURE, queue->future_list);
+			tmp_size = tmp_node->size;
 			tmp = tmp_node->next;
-			new_node->next = tmp;
 		}
 		while(is_marked(tmp));
 
-		index = hash(new_node->timestamp, queue->bucket_width);
+		if(!set_next(new_node, tmp, moved))
+		{
+			connect_to_be_freed_list(queue, new_node, 1);
+			return false;
+		}
+
+		index = bucket_index(queue, new_node->timestamp);
 	} while (index >= tmp_size
 			&& !(cas_result = CAS_x86(
 								(volatile unsigned long long *)&(tmp_node->next),
@@ -498,14 +1079,21 @@ static bool insert(nonblocking_queue* queue, bucket_node* new_node)
 	if (cas_result)
 		return false;
 
-	// node to be added in the hashtable
-	bucket = (bucket_node*)access_hashtable(queue->hashtable, index, queue->init_size, sizeof(bucket_node));
+	// node to be added in the hashtable. During an expansion of the ring, the dequeuers
+	// are still in the window ending at dequeue_size, which the new one follows
+	tmp_size = queue->dequeue_size;
+	*linked = first_bucket_in_use(queue, window_index(queue, index, tmp_size));
+	bucket = bucket_head_of(queue, *linked);
 
 	do
 	{
 		search(queue, bucket, new_node->timestamp, &left_node,
 				&right_node);
-		new_node->next = right_node;
+		if(!set_next(new_node, right_node, moved))
+		{
+			connect_to_be_freed_list(queue, new_node, 1);
+			return false;
+		}
 		new_node->counter = 1 + ( -D_EQUAL(new_node->timestamp, right_node->timestamp ) & right_node->counter );
 	} while (!CAS_x86(
 				(volatile unsigned long long*)&(left_node->next),
@@ -530,14 +1118,29 @@ static bool insert(nonblocking_queue* queue, bucket_node* new_node)
 static void empty_todo_list(nonblocking_queue* queue)
 {
 	bucket_node *tmp, *tmp_next, *tail, *head;
+#if RECLAMATION == RECLAMATION_HAZARD
+	bucket_node *link;
+#endif
+	index_t index;
 	tail = queue->tail;
-	head = queue->todo_list;
+	head = protected_read(HP_TODO, queue->todo_list);
 
 	// Try to disconnect the head node
 	do
 	{
-		tmp = get_unmarked(head->next);
-		tmp_next = tmp->next;
+#if RECLAMATION == RECLAMATION_HAZARD
+		// the link is marked, while the hazard scan looks for the unmarked address of the node
+		do
+		{
+			link = head->next;
+			tmp = get_unmarked(link);
+			protect(HP_RIGHT, tmp);
+		}
+		while(head->next != link);
+#else
+		tmp = get_unmarked(head->next);
+#endif
+		tmp_next = tmp->next;
 	} while (tmp != tail && !CAS_x86(
 				(volatile unsigned long long *)&(head->next),
 				(unsigned long long) get_marked(tmp),
@@ -545,13 +1148,112 @@ static void empty_todo_list(nonblocking_queue* queue)
 				)
 			);
 
-	//insert in the hashtable or in the future list again
-	if(tmp != tail)
-		insert(queue, tmp);
+	//insert in the hashtable or in the future list again. The expansion may end
+	// while the node is detached, thus current may have passed its bucket
+	if(tmp != tail && insert(queue, tmp, true, &index))
+		flush_current(queue, index);
+}
+
+#if ADAPTIVE_WIDTH == ADAPTIVE_WIDTH_ON
+__thread unsigned int width_dequeues = 0;
+__thread unsigned int width_advances = 0;
+
+/**
+ * This function accounts the events dequeued by the calling thread and, once per period,
+ * merges the events per bucket seen by the thread in the estimate of the queue.
+ * The ratio between dequeues and moves of current of a single thread follows the global one,
+ * thus no shared counter is needed.
+ *
+ * @param queue the interested queue
+ * @param dequeued the number of events just dequeued
+ */
+static inline void sample_density(nonblocking_queue *queue, unsigned int dequeued)
+{
+	double density, old_density;
+
+	width_dequeues += dequeued;
+	if(width_dequeues < WIDTH_SAMPLE_PERIOD)
+		return;
+
+	density = (double) width_dequeues / (width_advances + 1);
+	old_density = queue->density;
+	queue->density = old_density == 0.0 ? density : (3.0 * old_density + density) / 4.0;
+	width_dequeues = 0;
+	width_advances = 0;
+}
+
+#define sample_advance()	(width_advances++)
+
+/**
+ * This function sets the width of a segment before it is published. The width of the previous
+ * segment is kept unless its buckets turned out too crowded or too sparse.
+ * Any thread which expands the hashtable computes the same first timestamp of the segment,
+ * while the width is decided by the first CAS.
+ *
+ * @param queue the interested queue
+ * @param segment the first-level index of the new segment
+ */
+static void set_segment_width(nonblocking_queue *queue, unsigned int segment)
+{
+	union { double width; unsigned long long bits; } prev, width;
+	double density;
+
+	if(queue->segments > segment)
+		return;
+
+	prev.width = queue->widths[segment-1];
+	width.width = prev.width;
+	density = queue->density;
+	if(density > 0.0 && (density > 2.0 * WIDTH_TARGET_DENSITY || 2.0 * density < WIDTH_TARGET_DENSITY))
+		width.width = prev.width * WIDTH_TARGET_DENSITY / density;
+
+	CAS_x86((volatile unsigned long long *) &queue->widths[segment], 0ULL, width.bits);
+	queue->starts[segment] = queue->starts[segment-1]
+			+ (double) (segment_base(segment, queue->init_size) - segment_base(segment-1, queue->init_size)) * prev.width;
+
+	// the density scales with the width, thus the estimate stays meaningful for the new buckets
+	if(iCAS_x86(&queue->segments, segment, segment+1))
+		queue->density = density * queue->widths[segment] / prev.width;
+}
+#else
+#define sample_density(queue, dequeued)		do {} while(0)
+#define sample_advance()						do {} while(0)
+#define set_segment_width(queue, segment)		do {} while(0)
+#endif
+
+#if CALENDAR == CALENDAR_RING
+static pkey_t peek_future(nonblocking_queue *queue, bucket_node *future, pkey_t bound);
+
+/**
+ * This function computes the end of the window which follows the one ending at a given index.
+ * The window moves to the lap of the first event of the future list, thus the empty laps
+ * are skipped at once rather than moving the whole future list once per lap.
+ *
+ * @param queue the interested queue
+ * @param future the head of the future list, protected by the caller
+ * @param size the end of the current window
+ *
+ * @return the end of the next window
+ */
+static index_t next_window(nonblocking_queue *queue, bucket_node *future, index_t size)
+{
+	pkey_t min = peek_future(queue, future, INFTY);
+	index_t index, end = next_size(queue, size);
+
+	if(min == INFTY)
+		return end;
+
+	index = bucket_index(queue, min);
+	if(index >= end)
+		end = (index & ~((index_t) queue->init_size - 1)) + queue->init_size;
+	return end;
 }
+#endif
 
 /**
  * This function expand the hashtable of a queue without relocating the array.
+ * With the ring calendar no bucket is added: the window moves forward to the lap of the first
+ * event in the future list, and the events of the future list are moved to the buckets of the new window.
  *
  * @author Romolo Marotta
  *
@@ -560,11 +1262,14 @@ static void empty_todo_list(nonblocking_queue* queue)
  *
  * @return true if before it ends the dequeue size is increased
  */
-static bool expand_array(nonblocking_queue* queue, volatile unsigned int old_size)
+static bool expand_array(nonblocking_queue* queue, volatile index_t old_size)
 {
-	unsigned int i;
+#if CALENDAR == CALENDAR_LINEAR
+	index_t i;
+#endif
 	bucket_node *tail, *new_future, *future;
 	bucket_node *tmp, *tmp_next;
+	index_t new_size = next_size(queue, old_size);
 
 
 	if(queue->dequeue_size != old_size)
@@ -572,24 +1277,23 @@ static bool expand_array(nonblocking_queue* queue, volatile unsigned int old_siz
 
 	tail = queue->tail;
 
-	future = queue->future_list;
-	if(future->counter == old_size)
+	future = protected_read(HP_FUTURE, queue->future_list);
+	if(future->size == old_size)
 	{
+#if CALENDAR == CALENDAR_LINEAR
+		set_segment_width(queue, firstIndex(old_size, queue->init_size));
+
 		// Alloc new hashtable
-		bucket_node *tmp_new_heads = (bucket_node*) mm_std_malloc(sizeof(bucket_node) * old_size);
+		bucket_head *tmp_new_heads = (bucket_head*) mm_std_aligned_malloc(CACHE_LINE_SIZE, sizeof(bucket_head) * old_size);
 
 		if(tmp_new_heads == NULL)
 			error("No enough memory to allocate new hashtable");
 
-		bzero(tmp_new_heads, sizeof(bucket_node) * old_size);
+		bzero(tmp_new_heads, sizeof(bucket_head) * old_size);
 
 		// Copy the unchanged entries
 		for (i = 0; i < old_size; i++)
-		{
-			tmp_new_heads[i].timestamp = (old_size+i) * queue->bucket_width;
-			tmp_new_heads[i].counter = 0;
 			tmp_new_heads[i].next = tail;
-		}
 		// Init the head of new lists
 
 		if( CAS_x86(
@@ -602,10 +1306,11 @@ static bool expand_array(nonblocking_queue* queue, volatile unsigned int old_siz
 			//printf("%u - EXPAND START %u to %u\n", lid, old_size, old_size*2);
 		}
 		else
-			mm_free(tmp_new_heads);
+			mm_std_free(tmp_new_heads);
+#endif
 
-		tmp = queue->todo_list;
-		if(tmp->counter < old_size)
+		tmp = protected_read(HP_TODO, queue->todo_list);
+		if(tmp->size < old_size)
 
 			if(CAS_x86(
 					(unsigned long long*) &queue->todo_list,
@@ -615,8 +1320,11 @@ static bool expand_array(nonblocking_queue* queue, volatile unsigned int old_siz
 					connect_to_be_freed_list(queue, tmp, 1);
 
 
-		new_future = node_malloc(NULL, -4.0);
-		new_future->counter = old_size*2;
+#if CALENDAR == CALENDAR_RING
+		new_size = next_window(queue, future, old_size);
+#endif
+		new_future = sentinel_malloc();
+		new_future->size = new_size;
 		new_future->next = tail;
 
 
@@ -626,14 +1334,14 @@ static bool expand_array(nonblocking_queue* queue, volatile unsigned int old_siz
 				(unsigned long long)  new_future
 				)
 		)
-			mm_free(new_future);
+			release_node(queue, new_future);
 
 
 	}
 
 	do
 	{
-		tmp = queue->todo_list;
+		tmp = protected_read(HP_TODO, queue->todo_list);
 		tmp_next = tmp->next;
 	}
 	while(!is_marked(tmp_next)
@@ -645,70 +1353,318 @@ static bool expand_array(nonblocking_queue* queue, volatile unsigned int old_siz
 	);
 
 	// empty the to do list
-	tmp = queue->todo_list->next;
+	tmp = protected_read(HP_TODO, queue->todo_list)->next;
 
 	while (get_unmarked(tmp) != tail)
 	{
 		empty_todo_list(queue);
-		tmp = queue->todo_list->next;
+		tmp = protected_read(HP_TODO, queue->todo_list)->next;
 	}
 
 
-	iCAS_x86(&queue->dequeue_size, old_size, old_size*2);
+#if CALENDAR == CALENDAR_RING
+	// the new window is the one chosen by the thread which replaced the future list
+	new_size = protected_read(HP_FUTURE, queue->future_list)->size;
+#endif
+	CAS_size(&queue->dequeue_size, old_size, new_size);
 	return queue->dequeue_size > old_size;
 }
 
+/**
+ * This function is the default release function of a queue,
+ * which leaves the nodes provided by the caller untouched
+ */
+static void release_nothing(void *node)
+{
+	(void)node;
+}
+
+/**
+ * This function sets the function invoked on the nodes provided with enqueue_node,
+ * once no thread can reach them. It may be invoked by any thread.
+ *
+ * @param queue the interested queue
+ * @param release the function which takes back a node
+ */
+void queue_set_release(nonblocking_queue *queue, void (*release)(void*))
+{
+	queue->release = release;
+}
+
 /**
  * This function create an instance of a non-blocking calendar queue.
  *
  * @author Romolo Marotta
  *
- * @param queue_size is the inital size of the new queue
+ * @param queue_size is the inital size of the new queue, with the ring calendar
+ * the number of buckets in the window, rounded up to a power of two
+ * @param bucket_width the depth of a bucket, with integer keys rounded up to a power of two
  *
  * @return a pointer a new queue
  */
-nonblocking_queue* queue_init(unsigned int queue_size, double bucket_width, unsigned int collaborative_todo_list)
+nonblocking_queue* queue_init(unsigned int queue_size, pkey_t bucket_width, unsigned int collaborative_todo_list)
 {
 	unsigned int i = 0;
+#if KEY_TYPE == KEY_TICKS
+	unsigned int bucket_shift = 0;
+
+	while(bucket_shift < 63 && ((pkey_t) 1 << bucket_shift) < bucket_width)
+		bucket_shift++;
+	bucket_width = (pkey_t) 1 << bucket_shift;
+#endif
+
+#if CALENDAR == CALENDAR_RING
+	if(queue_size & (queue_size - 1))
+		queue_size = 2U << ibsr_x86(queue_size);
+#endif
 
 	nonblocking_queue* res = (nonblocking_queue*) mm_std_malloc(sizeof(nonblocking_queue));
 	if(res == NULL)
 		error("No enough memory to allocate queue\n");
 	memset(res, 0, sizeof(nonblocking_queue));
 
-	res->hashtable[0] = (bucket_node*) mm_std_malloc(sizeof(bucket_node) * queue_size);
-	if(res->hashtable == NULL)
+	res->hashtable[0] = (bucket_head*) mm_std_aligned_malloc(CACHE_LINE_SIZE, sizeof(bucket_head) * queue_size);
+	if(res->hashtable[0] == NULL)
 	{
 		mm_std_free(res);
 		error("No enough memory to allocate queue\n");
 	}
-	memset(res->hashtable[0], 0, sizeof(bucket_node) * queue_size);
+	memset(res->hashtable[0], 0, sizeof(bucket_head) * queue_size);
 
 	res->dequeue_size = queue_size;
-	res->tail = node_malloc(NULL, -4.0);
+	res->tail = sentinel_malloc();
 	res->tail->next = NULL;
 	res->tail->counter = 0;
 	res->bucket_width = bucket_width;
-	res->future_list = node_malloc(NULL, -4.0);
-	res->future_list->counter = queue_size;
+#if KEY_TYPE == KEY_TICKS
+	res->bucket_shift = bucket_shift;
+#endif
+	res->future_list = sentinel_malloc();
+	res->future_list->size = queue_size;
 	res->future_list->next = res->tail;
-	res->todo_list = node_malloc(NULL, -4.0);
-	res->todo_list->counter = 0;
+	res->todo_list = sentinel_malloc();
+	res->todo_list->size = 0;
 	res->todo_list->next = get_marked(res->tail);
-	res->current = ((unsigned long long) queue_size-1) << 32;
+	res->current = ((current_t) queue_size-1) << CURRENT_SHIFT;
 	res->collaborative_todo_list = collaborative_todo_list;
 	res->init_size = queue_size;
+	res->release = release_nothing;
+
+	res->sizes = (size_counter*) mm_std_aligned_malloc(CACHE_LINE_SIZE, sizeof(size_counter) * QUEUE_MAX_THREADS);
+	if(res->sizes == NULL)
+		error("No enough memory to allocate queue\n");
+	memset(res->sizes, 0, sizeof(size_counter) * QUEUE_MAX_THREADS);
+#if ADAPTIVE_WIDTH == ADAPTIVE_WIDTH_ON
+	res->segments = 1;
+	res->widths[0] = bucket_width;
+	res->starts[0] = 0.0;
+#endif
 
 	for (i = 0; i < queue_size; i++)
-	{
 		res->hashtable[0][i].next = res->tail;
-		res->hashtable[0][i].timestamp = i * bucket_width;
-		res->hashtable[0][i].counter = 0;
+
+	return res;
+}
+
+/**
+ * This function allocates a queue whose dequeue_entry is relaxed: each dequeuer claims a random event
+ * among the first T*log2(T)+1 live ones, thus T dequeuers seldom race on the same node.
+ * The other dequeue functions keep the strict order.
+ *
+ * @param queue_size the initial size of the hashtable
+ * @param bucket_width the width of the buckets
+ * @param collaborative_todo_list if the enqueuers help the expansions
+ * @param threads the number of dequeuers
+ *
+ * @return the pointer to the new queue
+ */
+nonblocking_queue* queue_init_relaxed(unsigned int queue_size, pkey_t bucket_width, unsigned int collaborative_todo_list, unsigned int threads)
+{
+	nonblocking_queue *res = queue_init(queue_size, bucket_width, collaborative_todo_list);
+
+	res->ranks = (rank_counter*) mm_std_aligned_malloc(CACHE_LINE_SIZE, sizeof(rank_counter) * QUEUE_MAX_THREADS);
+	if(res->ranks == NULL)
+		error("No enough memory to allocate queue\n");
+	memset(res->ranks, 0, sizeof(rank_counter) * QUEUE_MAX_THREADS);
+
+	res->spray_width = threads == 0 ? 1 : threads * ibsr_x86(threads) + 1;
+	return res;
+}
+
+/**
+ * This function returns the rank error of the dequeues of a relaxed queue, namely the number
+ * of live events which preceded the dequeued ones in the walk from current
+ *
+ * @param queue the interested queue
+ * @param max used to return the largest rank error, if not NULL
+ *
+ * @return the average rank error, 0 if the queue is strict or no event has been dequeued
+ */
+double queue_rank_error(nonblocking_queue *queue, unsigned long long *max)
+{
+	unsigned long long samples = 0, sum = 0, res_max = 0;
+	unsigned int i;
+
+	for(i = 0; queue->ranks != NULL && i < QUEUE_MAX_THREADS; i++)
+	{
+		samples += queue->ranks[i].samples;
+		sum += queue->ranks[i].sum;
+		if(queue->ranks[i].max > res_max)
+			res_max = queue->ranks[i].max;
+	}
+
+	if(max != NULL)
+		*max = res_max;
+	return samples == 0 ? 0.0 : (double) sum / (double) samples;
+}
+
+/**
+ * This function collaborates in emptying the todo_list, if enabled for the queue
+ *
+ * @param queue
+ */
+static void collaborate_todo_list(nonblocking_queue* queue)
+{
+	bucket_node *tmp;
+	bucket_node *tail;
+
+	if(!queue->collaborative_todo_list)
+		return;
+
+	// empty the to do list
+	tail = queue->tail;
+	tmp = protected_read(HP_TODO, queue->todo_list);
+	tmp = tmp->next;
+	while (get_unmarked(tmp) != tail)
+	{
+		empty_todo_list(queue);
+		tmp = protected_read(HP_TODO, queue->todo_list);
+		tmp = tmp->next;
+	}
+}
+
+/**
+ * This function links an initialised node in the queue, moves current backward if necessary
+ * and collaborates in emptying the todo_list
+ *
+ * @param queue
+ * @param new_node the node to be linked
+ *
+ * @return true if the event is inserted in the hashtable, else false
+ */
+static bool link_node(nonblocking_queue* queue, bucket_node *new_node)
+{
+	index_t index;
+	bool res;
+
+	// the event is counted before it is visible, so that is_empty never misses it
+	count_events(queue, 1);
+	critical_enter();
+	res = insert(queue, new_node, false, &index);
+	// Try to flush the new current if necessary
+	if(res)
+		flush_current(queue, index);
+
+	// Collaborate in emptying the todo_list
+	collaborate_todo_list(queue);
+	critical_exit();
+	return res;
+}
+
+/**
+ * This function sorts by timestamp the first n nodes of a list linked through their next field.
+ * The sort is stable, thus nodes with the same timestamp keep the order in which insert
+ * would leave them if they were enqueued one at a time.
+ *
+ * @param list a pointer to the list, which is advanced past the sorted nodes
+ * @param n the number of nodes to be sorted, greater than zero
+ *
+ * @return the sorted list, terminated by NULL
+ */
+static bucket_node* sort_nodes(bucket_node **list, unsigned int n)
+{
+	bucket_node *left, *right, *res, **tail;
+
+	if(n == 1)
+	{
+		res = *list;
+		*list = res->next;
+		res->next = NULL;
+		return res;
+	}
+
+	left = sort_nodes(list, n/2);
+	right = sort_nodes(list, n - n/2);
+	tail = &res;
+
+	while(left != NULL && right != NULL)
+	{
+		if(right->timestamp < left->timestamp && !D_EQUAL(right->timestamp, left->timestamp))
+		{
+			*tail = right;
+			right = right->next;
+		}
+		else
+		{
+			*tail = left;
+			left = left->next;
+		}
+		tail = (bucket_node**) &((*tail)->next);
 	}
+	*tail = (left != NULL) ? left : right;
 
 	return res;
 }
 
+/**
+ * This function links a sorted run of nodes falling in the same bucket. Each search
+ * links the longest prefix of the run which precedes its right node with a single CAS,
+ * thus the run is split only around the events already in the bucket.
+ *
+ * @param queue
+ * @param bucket the head of the bucket
+ * @param first the first node of the run
+ * @param n the number of nodes in the run
+ */
+static void insert_run(nonblocking_queue* queue, bucket_node *bucket, bucket_node *first, unsigned int n)
+{
+	bucket_node *left_node, *right_node, *last, *rest, *tmp;
+	unsigned int len;
+
+	while(n != 0)
+	{
+		while(true)
+		{
+			search(queue, bucket, first->timestamp, &left_node, &right_node);
+
+			last = first;
+			len = 1;
+			while(len < n && (right_node == queue->tail ||
+					(last->next->timestamp < right_node->timestamp
+					&& !D_EQUAL(last->next->timestamp, right_node->timestamp))))
+			{
+				last = last->next;
+				len++;
+			}
+			rest = last->next;
+			last->next = right_node;
+
+			for(tmp = first; tmp != right_node; tmp = tmp->next)
+				tmp->counter = 1 + ( -D_EQUAL(tmp->timestamp, right_node->timestamp ) & right_node->counter );
+
+			if(CAS_x86(
+					(volatile unsigned long long*)&(left_node->next),
+					(unsigned long long) right_node,
+					(unsigned long long) first
+					))
+				break;
+			last->next = rest;
+		}
+		first = rest;
+		n -= len;
+	}
+}
+
 /**
  * This function implements the enqueue interface of the non-blocking queue.
  * Should cost O(1) when succeeds
@@ -719,64 +1675,204 @@ nonblocking_queue* queue_init(unsigned int queue_size, double bucket_width, unsi
  * @param timestamp the key associated with the value
  * @param payload the event to be enqueued
  *
- * @return true if the event is inserted in the hashtable, else false
+ * @return true if the event is inserted in the hashtable or handed to a dequeuer, else false
  */
-bool enqueue(nonblocking_queue* queue, double timestamp, void* payload)
+bool enqueue(nonblocking_queue* queue, pkey_t timestamp, void* payload)
 {
+#if ELIMINATION == ELIMINATION_ON
+	if(eliminate_enqueue(queue, timestamp, payload))
+		return true;
+#endif
 	// allocates a new node
-	bucket_node *new_node = node_malloc(payload, timestamp);
-	bool res = insert(queue, new_node);
-	// Try to flush the new current if necessary
-	if(res)
-		flush_current(queue, hash(new_node->timestamp, queue->bucket_width));
+	return link_node(queue, node_malloc(payload, timestamp));
+}
 
-	// Collaborate in emptying the todo_list
+/**
+ * This function implements the intrusive enqueue interface of the non-blocking queue.
+ * The node is provided by the caller, usually embedded in its own event, and it is given back
+ * through the release function of the queue once no thread can reach it anymore.
+ * Until then, the caller must not modify it. The generation in the flags of the node is
+ * kept, so that the handles taken while it held an earlier event do not match it.
+ *
+ * @param queue
+ * @param node the node to be linked
+ * @param timestamp the key associated with the value
+ * @param payload the event to be enqueued
+ *
+ * @return true if the event is inserted in the hashtable, else false
+ */
+bool enqueue_node(nonblocking_queue* queue, bucket_node *node, pkey_t timestamp, void* payload)
+{
+	node->counter = 1;
+	node->flags = (node->flags & ~NODE_KIND) | NODE_INTRUSIVE;
+	node->next = NULL;
+	node->payload = payload;
+	node->timestamp = timestamp;
 
-	// empty the to do list
-	if(queue->collaborative_todo_list)
+	return link_node(queue, node);
+}
+
+/**
+ * This function enqueues an event and returns a handle to it, which can be passed to cancel
+ * and reschedule. Once the event is dequeued, its node may be freed and reused, but the
+ * generation kept in the handle no longer matches the node, thus a late cancel fails.
+ *
+ * @param queue
+ * @param timestamp the key associated with the value
+ * @param payload the event to be enqueued
+ *
+ * @return the handle of the event
+ */
+queue_handle enqueue_handle(nonblocking_queue* queue, pkey_t timestamp, void* payload)
+{
+	bucket_node *node = node_malloc(payload, timestamp);
+	queue_handle handle = { node, node->flags & ~NODE_KIND };
+
+	link_node(queue, node);
+	return handle;
+}
+
+/**
+ * This function commits a batch of events to the queue. The batch is sorted locally
+ * and the events falling in the same bucket are linked together, so that a burst of
+ * events pays one traversal and one CAS per bucket instead of one per event.
+ *
+ * @param queue
+ * @param timestamps the keys associated with the values
+ * @param payloads the events to be enqueued
+ * @param n the number of events in the batch
+ *
+ * @return the number of events inserted in the hashtable, the others are in the future list
+ */
+unsigned int enqueue_batch(nonblocking_queue* queue, pkey_t *timestamps, void **payloads, unsigned int n)
+{
+	bucket_node *list, *first, *last, *next, *bucket, *tmp_node;
+	unsigned int i, len, res = 0;
+	index_t index, tmp_size, min_index = (index_t) -1;
+
+	if(n == 0)
+		return 0;
+
+	list = NULL;
+	for(i = n; i > 0; i--)
 	{
-		bucket_node *tmp;
-		bucket_node *tail;
+		first = node_malloc(payloads[i-1], timestamps[i-1]);
+		first->next = list;
+		list = first;
+	}
+	list = sort_nodes(&list, n);
 
-		tail = queue->tail;
-		tmp = queue->todo_list;
-		tmp = tmp->next;
-		while (get_unmarked(tmp) != tail)
+	count_events(queue, n);
+	critical_enter();
+	while(list != NULL)
+	{
+		first = list;
+		index = bucket_index(queue, first->timestamp);
+
+		tmp_node = protected_read(HP_FUTURE, queue->future_list);
+		tmp_size = tmp_node->size;
+
+		// the events beyond the hashtable, or met during an expansion, follow the usual path
+		if(index >= tmp_size || is_marked(tmp_node->next))
+		{
+			list = first->next;
+			if(insert(queue, first, false, &index))
+			{
+				res++;
+				if(index < min_index)
+					min_index = index;
+			}
+			continue;
+		}
+
+		last = first;
+		len = 1;
+		while((next = last->next) != NULL && bucket_index(queue, next->timestamp) == index)
 		{
-			empty_todo_list(queue);
-			tmp = queue->todo_list;
-			tmp = tmp->next;
+			last = next;
+			len++;
 		}
+		list = next;
+
+		tmp_size = queue->dequeue_size;
+		index = first_bucket_in_use(queue, window_index(queue, index, tmp_size));
+		bucket = bucket_head_of(queue, index);
+		insert_run(queue, bucket, first, len);
+		res += len;
+		if(index < min_index)
+			min_index = index;
 	}
+
+	// Try to flush the new current once for the whole batch
+	if(res != 0)
+		flush_current(queue, min_index);
+
+	collaborate_todo_list(queue);
+	critical_exit();
 	return res;
 }
 
 /**
- * This function dequeue from the nonblocking queue. The cost of this operation when succeeds should be O(1)
- *
- * @author Romolo Marotta
+ * This function extracts the minimum from the nonblocking queue. The cost of this operation when succeeds should be O(1).
+ * The dequeued events are copied in structs provided by the caller, thus no node is allocated.
+ * After the first event, the following ones are claimed from the same bucket as long as
+ * current is unchanged, i.e. no smaller event has been inserted in the meanwhile.
  *
  * @param queue the interested queue
+ * @param entries used to return timestamp, counter and payload of the dequeued events
+ * @param k the maximum number of events to be dequeued, greater than zero
+ * @param first used to return the marked node of the first event, NULL if the caller needs no node,
+ * in which case the event may be handed over by an enqueuer through the elimination array
+ * @param bound the events with a timestamp not less than it are left in the queue
  *
- * @return a pointer to a node that contains the dequeued value
+ * @return the number of dequeued events, 0 if the queue is empty or its minimum does not precede the bound,
+ * in which case the timestamp of the first entry is INFTY or the one of the minimum
  *
  */
-bucket_node* dequeue(nonblocking_queue *queue)
+static unsigned int extract_min(nonblocking_queue *queue, queue_entry *entries, unsigned int k, bucket_node **first, pkey_t bound)
 {
-	bucket_node *right_node, *min, *min_next, *right_node_next, *candidate, *res, *tail;
-	unsigned int index;
-	unsigned int tmp_size;
+	bucket_node *right_node, *min, *right_node_next, *candidate, *tail;
+	index_t index;
+	index_t tmp_size;
+	unsigned int count = 0;
+	current_t oldCurrent;
+#if RECLAMATION != RECLAMATION_HAZARD
+	bucket_node *min_next;
 	unsigned int to_remove_counter;
-	unsigned long long oldCurrent;
+#endif
 
 	tail = queue->tail;
-	res = NULL;
+	critical_enter();
 	do
 	{
 		// 1. Check if there are no events
-		oldCurrent = queue->current;
-		index = (unsigned int)(oldCurrent >> 32);
-		min = (bucket_node*) access_hashtable(queue->hashtable, index, queue->init_size, sizeof(bucket_node));
+		if(count == 0)
+		{
+			oldCurrent = read_current(queue);
+			index = first_bucket_in_use(queue, current_index(oldCurrent));
+			min = bucket_head_of(queue, index);
+		}
+		// Stop claiming if enough events are taken or a smaller one may have been inserted
+		else if(count == k || !same_current(queue, oldCurrent))
+			break;
+#if RECLAMATION == RECLAMATION_HAZARD
+		// 2-4. Disconnect the marked nodes at the beginning of the bucket one at a time,
+		// so that the candidate is always protected by a hazard pointer
+		right_node = protected_read(HP_RIGHT, min->next);
+		right_node_next = right_node->next;
+
+		if (is_marked(right_node_next))
+		{
+			if (CAS_x86(
+					(volatile unsigned long long *)&(min->next),
+					(unsigned long long) right_node,
+					(unsigned long long) get_unmarked(right_node_next)
+					)
+				)
+				retire_node(queue, right_node);
+			continue;
+		}
+#else
 		to_remove_counter = 0;
 		right_node_next = (bucket_node*)0xDEADC0DE;
 		// 2. Check if current is marked and find left node
@@ -813,79 +1909,1172 @@ bucket_node* dequeue(nonblocking_queue *queue)
 				continue;
 			connect_to_be_freed_list(queue, min_next, to_remove_counter);
 		}
+#endif
 
 		candidate = right_node;
 		//printf("%u - CHECK R:%p RN:%p, T:%p TN:%p I:%u M:%p MN:%p\n", lid, right_node, right_node_next, tail, tail->next, index, min, min_next);
-		// 5. Right node is a tail.
-		if (candidate == queue->tail)
+		// 5. Right node is a tail, or the bucket holds only events of a later lap
+		if (candidate == queue->tail || later_lap(queue, candidate, index))
 		{
+			// the events claimed so far are the last ones of the bucket
+			if(count != 0)
+				break;
+
 			// 7. get next bucket
 			tmp_size = queue->dequeue_size;
 			//index = hash(min->timestamp, queue->bucket_width) + 1;
 			index++;
-			// 8. Find new right node, that should be a head.
-			if (index < tmp_size)
-				candidate = (bucket_node*)access_hashtable(queue->hashtable, index, queue->init_size, sizeof(bucket_node));
-			else
+			// 8. The next bucket has to be covered by the hashtable
+			if (index >= tmp_size)
 			{
-				bucket_node *future = queue->future_list;
+				bucket_node *future = protected_read(HP_FUTURE, queue->future_list);
 
-				if (future->next == tail && future->counter == tmp_size)
+				if (future->next == tail && future->size == tmp_size)
 				{
-					res = node_malloc(NULL, INFTY);
-					return res;
+					entries->timestamp = INFTY;
+					entries->counter = 0;
+					entries->payload = NULL;
+					if(first != NULL)
+						*first = NULL;
+					critical_exit();
+					return 0;
 				}
 
-				else if(expand_array(queue, tmp_size))
-					candidate = (bucket_node*)access_hashtable(queue->hashtable, index, queue->init_size, sizeof(bucket_node));
-				else
+				else if(!expand_array(queue, tmp_size))
 					continue;
+
+				// the new window may start several laps later
+				index = window_index(queue, index, queue->dequeue_size);
 			}
 
+			// 9. Move current to the next bucket. Heads hold only a pointer,
+			// thus they are never candidates
+			if(CAS_current(queue, oldCurrent, new_current(index)))
+				sample_advance();
+			continue;
 		}
 		//printf("%u - CHECK2 R:%p RN:%p, T:%p TN:%p I:%u M:%p MN:%p\n", lid, candidate, NULL, tail, tail->next, index, min, min_next);
 
-		// 6. If the right node is not a tail // Try to update current and then Check that nothing is changed
-		// 9. Set current temporarily to the right node
+		// 6. The right node is not a tail, thus try to mark it unless it follows the bound
+		if(candidate->timestamp >= bound)
+		{
+			if(count == 0)
+			{
+				entries->timestamp = candidate->timestamp;
+				entries->counter = 0;
+				entries->payload = NULL;
+				if(first != NULL)
+					*first = NULL;
+			}
+			break;
+		}
+
 		// 10. Nothing is changed
 
-		if( candidate->counter != 0 )
+		// fields are copied before marking, since a marked node can be reused
+		entries[count].timestamp = candidate->timestamp;
+		entries[count].counter = candidate->counter;
+		entries[count].payload = candidate->payload;
+		// 11. If something changed, retry
+		if(CAS_x86(
+				(volatile unsigned long long *)&(candidate->next),
+				(unsigned long long) right_node_next,
+				(unsigned long long) get_marked(right_node_next)
+				)
+			)
 		{
-			res = node_malloc(candidate, candidate->timestamp);
-			res->counter = candidate->counter;
-			// 11. Something changed, thus restore current
-			if(CAS_x86(
-					(volatile unsigned long long *)&(candidate->next),
-					(unsigned long long) right_node_next,
-					(unsigned long long) get_marked(right_node_next)
+			//printf("%u - CAN OK %p\n", lid, candidate);
+			if(count++ == 0 && first != NULL)
+				*first = candidate;
+#if RECLAMATION == RECLAMATION_HAZARD
+			// 12. Disconnect the candidate, so that its successor can be protected from the head
+			if (count != k && CAS_x86(
+					(volatile unsigned long long *)&(min->next),
+					(unsigned long long) candidate,
+					(unsigned long long) right_node_next
 					)
 				)
+				retire_node(queue, candidate);
+#else
+			// 12. Claim the successors, the marked run is disconnected by the next dequeue
+			candidate = right_node_next;
+			while(count != k && candidate != tail && !later_lap(queue, candidate, index)
+					&& candidate->timestamp < bound && same_current(queue, oldCurrent))
 			{
-				//printf("%u - CAN OK %p\n", lid, candidate);
-				return res;
+				right_node_next = candidate->next;
+				if (is_marked(right_node_next))
+				{
+					candidate = get_unmarked(right_node_next);
+					continue;
+				}
+				entries[count].timestamp = candidate->timestamp;
+				entries[count].counter = candidate->counter;
+				entries[count].payload = candidate->payload;
+				if(CAS_x86(
+						(volatile unsigned long long *)&(candidate->next),
+						(unsigned long long) right_node_next,
+						(unsigned long long) get_marked(right_node_next)
+						)
+					)
+				{
+					count++;
+					candidate = right_node_next;
+				}
 			}
-
-			mm_free(res);
-			res = NULL;
+			break;
+#endif
 		}
-
-		else
-			CAS_x86(
-					(volatile unsigned long long *)&(queue->current),
-					(unsigned long long)oldCurrent,
-					( ( (unsigned long long) index ) << 32) | generate_mark()
-					//(((unsigned long long)hash(candidate->timestamp, queue->bucket_width)) << 32)
-					)
-				;
+#if ELIMINATION == ELIMINATION_ON
+		// 13. Another dequeuer claimed the minimum: rather than racing again on the same bucket,
+		// wait for an enqueuer of an earlier event
+		else if(count == 0 && first == NULL
+				&& eliminate_dequeue(queue, entries->timestamp < bound ? entries->timestamp : bound, entries))
+		{
+			critical_exit();
+			return 1;
+		}
+#endif
 
 	}while(1);
-	return NULL;
+
+	critical_exit();
+	if(count != 0)
+		count_events(queue, -(long long) count);
+	sample_density(queue, count);
+	return count;
+}
+
+/**
+ * This function disconnects the sequence of marked nodes at the beginning of a bucket
+ *
+ * @param queue the queue that contains the bucket
+ * @param head the head of the bucket
+ */
+#if RECLAMATION == RECLAMATION_HAZARD
+static void unlink_marked_prefix(nonblocking_queue *queue, bucket_node *head)
+{
+	bucket_node *right_node, *right_node_next;
+
+	do
+	{
+		right_node = protected_read(HP_RIGHT, head->next);
+		right_node_next = right_node->next;
+
+		if (!is_marked(right_node_next))
+			return;
+
+		if (CAS_x86(
+				(volatile unsigned long long *)&(head->next),
+				(unsigned long long) right_node,
+				(unsigned long long) get_unmarked(right_node_next)
+				)
+			)
+			retire_node(queue, right_node);
+	}
+	while (1);
+}
+#else
+static void unlink_marked_prefix(nonblocking_queue *queue, bucket_node *head)
+{
+	bucket_node *left_next, *right_node, *right_node_next;
+	unsigned int to_remove_counter;
+
+	do
+	{
+		left_next = head->next;
+		right_node = left_next;
+		right_node_next = right_node->next;
+		to_remove_counter = 0;
+
+		while (is_marked(right_node_next))
+		{
+			to_remove_counter++;
+			right_node = get_unmarked(right_node_next);
+			right_node_next = right_node->next;
+		}
+	}
+	while (	left_next != right_node
+			&& !CAS_x86(
+					(volatile unsigned long long *)&(head->next),
+					(unsigned long long) left_next,
+					(unsigned long long) right_node
+					)
+			);
+
+	if (left_next != right_node)
+		connect_to_be_freed_list(queue, left_next, to_remove_counter);
+}
+#endif
+
+/**
+ *  Cursor of a read-only walk of a bucket or of the future list. With hazard pointers,
+ *  a node of a bucket is reachable as long as the last live node met still points to
+ *  the first node after it, since a marked run is disconnected at once. The future list
+ *  loses no node until an expansion marks its head.
+ */
+typedef struct list_walk list_walk;
+struct list_walk
+{
+	bucket_node *head;		// head of the list
+	bucket_node *left;		// last live node met, NULL in the future list
+	bucket_node *run;		// node following left when it was met
+	bucket_node *node;		// node reached
+#if RECLAMATION == RECLAMATION_HAZARD
+	unsigned int slot;		// hazard pointer to be used for the node reached
+#endif
+};
+
+/**
+ * This function starts a walk from the first node after a head
+ *
+ * @param walk the cursor
+ * @param head the head of a bucket or of the future list, protected by the caller
+ * @param future true if head is the head of the future list
+ */
+static inline void walk_begin(list_walk *walk, bucket_node *head, bool future)
+{
+	walk->head = head;
+	walk->left = future ? NULL : head;
+	// a single read, so that the node reached is the one validated through left
+	walk->run = head->next;
+	walk->node = walk->run;
+#if RECLAMATION == RECLAMATION_HAZARD
+	walk->slot = HP_RIGHT;
+#endif
+}
+
+/**
+ * This function protects the node reached and checks that it is still in the list
+ *
+ * @param walk the cursor
+ *
+ * @return false if the node may have been disconnected, thus the walk must be started again
+ */
+static inline bool walk_reached(list_walk *walk)
+{
+#if RECLAMATION == RECLAMATION_HAZARD
+	protect(walk->slot, walk->node);
+	if(walk->left == NULL ? is_marked(walk->head->next) : walk->left->next != walk->run)
+		return false;
+	walk->slot = walk->slot == HP_RIGHT ? HP_NEXT : HP_RIGHT;
+#else
+	(void) (walk);
+#endif
+	return true;
+}
+
+/**
+ * This function moves a walk to the node which follows the one reached
+ *
+ * @param walk the cursor
+ * @param next the next field of the node reached, as read by the caller
+ */
+static inline void walk_step(list_walk *walk, bucket_node *next)
+{
+#if RECLAMATION == RECLAMATION_HAZARD
+	if(walk->left != NULL && !is_marked(next))
+	{
+		protect(HP_LEFT, walk->node);
+		walk->left = walk->node;
+		walk->run = next;
+	}
+#endif
+	walk->node = get_unmarked(next);
+}
+
+/**
+ * This function skips a number of live nodes of a bucket, the ones of a later lap excluded
+ *
+ * @param queue the queue that contains the bucket
+ * @param head the head of the bucket
+ * @param index the index of the bucket
+ * @param skip the number of live nodes to be skipped, decreased by the ones met if they are fewer
+ *
+ * @return the live node reached, protected by a hazard pointer, or NULL if the bucket ends before
+ */
+static bucket_node* spray_bucket(nonblocking_queue *queue, bucket_node *head, index_t index, unsigned int *skip)
+{
+	list_walk walk;
+	bucket_node *next, *tail;
+	unsigned int skipped;
+	tail = queue->tail;
+
+try_again:
+	skipped = 0;
+	walk_begin(&walk, head, false);
+
+	while(walk.node != tail)
+	{
+		if(!walk_reached(&walk))
+			goto try_again;
+		if(later_lap(queue, walk.node, index))
+			break;
+
+		next = walk.node->next;
+		if(!is_marked(next))
+		{
+			if(skipped == *skip)
+				return walk.node;
+			skipped++;
+		}
+		walk_step(&walk, next);
+	}
+
+	*skip -= skipped;
+	return NULL;
+}
+
+/**
+ * This function claims a random event among the first live ones of the queue, so that
+ * concurrent dequeuers do not race on the same candidate as in a SprayList.
+ * The walk starts from current and crosses at most one bucket for each node to be skipped.
+ *
+ * @param queue the interested queue
+ * @param entry used to return timestamp, counter and payload of the dequeued event
+ * @param rank used to return the number of live events skipped
+ *
+ * @return true if an event is dequeued, false if the walk ends before the chosen node or its CAS fails
+ */
+static bool spray_min(nonblocking_queue *queue, queue_entry *entry, unsigned int *rank)
+{
+	bucket_node *candidate = NULL, *next;
+	index_t index, end;
+	unsigned int skip;
+	bool res = false;
+
+	*rank = queue_random() % queue->spray_width;
+	skip = *rank;
+
+	critical_enter();
+	index = first_bucket_in_use(queue, current_index(queue->current));
+	end = index + queue->spray_width;
+	if(end > queue->dequeue_size)
+		end = queue->dequeue_size;
+
+	// the nodes claimed by the walks are disconnected here, since they can be far from the minimum
+	unlink_marked_prefix(queue, bucket_head_of(queue, index));
+
+	for(; index < end && candidate == NULL; index++)
+		candidate = spray_bucket(queue, bucket_head_of(queue, index), index, &skip);
+
+	if(candidate != NULL)
+	{
+		// fields are copied before marking, since a marked node can be reused
+		entry->timestamp = candidate->timestamp;
+		entry->counter = candidate->counter;
+		entry->payload = candidate->payload;
+		next = candidate->next;
+		res = !is_marked(next) && CAS_x86(
+				(volatile unsigned long long *)&(candidate->next),
+				(unsigned long long) next,
+				(unsigned long long) get_marked(next)
+				);
+	}
+	critical_exit();
+
+	if(res)
+		count_events(queue, -1);
+	return res;
+}
+
+/**
+ * This function dequeue from the nonblocking queue. The cost of this operation when succeeds should be O(1).
+ * The dequeued event is copied in a struct provided by the caller, thus no node is allocated.
+ * A queue created with queue_init_relaxed claims a random event among the first ones,
+ * and falls back to the minimum when they are too few.
+ *
+ * @param queue the interested queue
+ * @param entry used to return timestamp, counter and payload of the dequeued event
+ *
+ * @return QUEUE_OK if an event has been dequeued, QUEUE_EMPTY if the queue is empty
+ *
+ */
+int dequeue_entry(nonblocking_queue *queue, queue_entry *entry)
+{
+	unsigned int rank;
+
+	if(queue->spray_width <= 1)
+		return extract_min(queue, entry, 1, NULL, INFTY) != 0 ? QUEUE_OK : QUEUE_EMPTY;
+
+	if(!spray_min(queue, entry, &rank))
+	{
+		if(extract_min(queue, entry, 1, NULL, INFTY) == 0)
+			return QUEUE_EMPTY;
+		rank = 0;
+	}
+
+	count_rank(queue, rank);
+	return QUEUE_OK;
+}
+
+/**
+ * This function dequeues the minimum only if it precedes a bound. The timestamp of the candidate
+ * is checked before it is marked, thus a failed test leaves the queue untouched and
+ * the event keeps its position among the ones with the same timestamp.
+ *
+ * @param queue the interested queue
+ * @param bound the minimum is dequeued if its timestamp is strictly less than it
+ * @param entry used to return the dequeued event, or the timestamp of the minimum if it follows the bound
+ *
+ * @return QUEUE_OK if an event has been dequeued, QUEUE_EMPTY if the queue is empty,
+ * QUEUE_LATER if the minimum does not precede the bound
+ *
+ */
+int dequeue_if_below(nonblocking_queue *queue, pkey_t bound, queue_entry *entry)
+{
+	if(extract_min(queue, entry, 1, NULL, bound) != 0)
+		return QUEUE_OK;
+
+	return entry->timestamp == INFTY ? QUEUE_EMPTY : QUEUE_LATER;
+}
+
+/**
+ * This function dequeues up to k events with a single pass on the current bucket,
+ * instead of restarting the whole dequeue for each event.
+ * The dequeued events are copied in structs provided by the caller, in timestamp order.
+ *
+ * @param queue the interested queue
+ * @param entries an array of at least k structs used to return the dequeued events
+ * @param k the maximum number of events to be dequeued
+ *
+ * @return the number of dequeued events, 0 if the queue is empty
+ *
+ */
+unsigned int dequeue_many(nonblocking_queue *queue, queue_entry *entries, unsigned int k)
+{
+	if(k == 0)
+		return 0;
+
+	return extract_min(queue, entries, k, NULL, INFTY);
+}
+
+/**
+ * This function dequeues every event which precedes a bound, up to a maximum, e.g. the events
+ * below the lower bound on the timestamps that a conservative engine can still receive.
+ * The events are claimed from current forward, bucket after bucket, with the same marking CAS
+ * of dequeue, and an event not preceding the bound is never claimed: the scan stops at the first one.
+ * The dequeued events are copied in structs provided by the caller, in timestamp order.
+ *
+ * @param queue the interested queue
+ * @param bound the events with a timestamp strictly less than it are dequeued
+ * @param entries an array of at least max structs used to return the dequeued events
+ * @param max the maximum number of events to be dequeued
+ *
+ * @return the number of dequeued events, 0 if no event precedes the bound
+ *
+ */
+unsigned int dequeue_window(nonblocking_queue *queue, pkey_t bound, queue_entry *entries, unsigned int max)
+{
+	unsigned int count, res = 0;
+
+	// each call claims the events of one bucket, then the next call moves current forward
+	while(res != max)
+	{
+		count = extract_min(queue, entries + res, max - res, NULL, bound);
+		if(count == 0)
+			break;
+		res += count;
+	}
+
+	return res;
+}
+
+/**
+ * This function implements the intrusive dequeue interface of the non-blocking queue.
+ * It is meant for queues filled with enqueue_node: the returned node belongs to the caller,
+ * but it can be reused only after the release function of the queue has been invoked on it.
+ * Until then, the queue may still write the node: with RECLAMATION_PRUNE, the thread which
+ * disconnects it overwrites its payload and counter to chain it to the nodes waiting for prune.
+ * Thus the event is to be read through node_container, and only the timestamp of the node.
+ *
+ * @param queue the interested queue
+ *
+ * @return the node of the dequeued event, or NULL if the queue is empty
+ *
+ */
+bucket_node* dequeue_node(nonblocking_queue *queue)
+{
+	queue_entry entry;
+	bucket_node *node;
+
+	extract_min(queue, &entry, 1, &node, INFTY);
+	return node;
+}
+
+/**
+ * This function dequeue from the nonblocking queue. The cost of this operation when succeeds should be O(1)
+ *
+ * @author Romolo Marotta
+ *
+ * @param queue the interested queue
+ *
+ * @return a pointer to a node that contains the dequeued value, which has to be freed with mm_free.
+ * If the queue is empty, the node has an infinite timestamp.
+ *
+ */
+bucket_node* dequeue(nonblocking_queue *queue)
+{
+	queue_entry entry;
+	bucket_node *res;
+
+	if(dequeue_entry(queue, &entry) == QUEUE_EMPTY)
+		return node_malloc(NULL, INFTY);
+
+	res = node_malloc(entry.payload, entry.timestamp);
+	res->counter = entry.counter;
+	return res;
+}
+
+/**
+ * This function marks a node as dequeue does, unless it is already marked
+ *
+ * @param node the node to be marked
+ *
+ * @return true if the node is marked by the caller
+ */
+static inline bool mark_node(bucket_node *node)
+{
+	bucket_node *next;
+
+	do
+	{
+		next = node->next;
+		if(is_marked(next))
+			return false;
+	}
+	while(!CAS_x86(
+			(volatile unsigned long long *)&(node->next),
+			(unsigned long long) next,
+			(unsigned long long) get_marked(next)
+			)
+		);
+
+	return true;
+}
+
+/**
+ * This function marks the node of a handle, if the node still holds the event of the handle.
+ * The generation of a node changes before it is handed to the reclamation scheme, and the
+ * node is protected before its generation is read, thus a node which matches the handle
+ * cannot be freed and reused until the caller leaves the critical region.
+ *
+ * @param handle the handle of the event
+ *
+ * @return true if the caller marked the node
+ */
+static bool mark_handle(queue_handle handle)
+{
+	protect(HP_RIGHT, handle.node);
+	if((handle.node->flags & ~NODE_KIND) != handle.generation)
+		return false;
+
+	return mark_node(handle.node);
+}
+
+/**
+ * This function removes a pending event. The node is marked as dequeue does, thus it is
+ * skipped by any dequeue and physically unlinked by the next search or dequeue which meets it.
+ * A node marked in the future list is dropped when an expansion moves it.
+ *
+ * @param queue the interested queue
+ * @param handle the handle returned by enqueue_handle or reschedule, or taken with node_handle
+ *
+ * @return true if the event is cancelled, false if it has already been dequeued or cancelled
+ *
+ */
+bool cancel(nonblocking_queue *queue, queue_handle handle)
+{
+	bool res;
+
+	critical_enter();
+	res = mark_handle(handle);
+	critical_exit();
+
+	if(res)
+		count_events(queue, -1);
+	return res;
+}
+
+/**
+ * This function moves a pending event to a new timestamp. The old node is marked as cancel does
+ * and the event is linked again with a node taken from the pool of the calling thread, while the
+ * old one is recycled by the reclamation scheme: it cannot be linked again in place, since
+ * concurrent searches may still be traversing it. Thus an event linked by enqueue_node cannot be
+ * moved, since the caller owns its node: it is to be cancelled, and its node enqueued again
+ * once the queue releases it.
+ *
+ * @param queue the interested queue
+ * @param handle the handle returned by enqueue_handle or reschedule
+ * @param timestamp the new key of the event
+ *
+ * @return the new handle of the event, whose node is NULL if the event has already been dequeued
+ * or cancelled, or if its node was given to enqueue_node
+ *
+ */
+queue_handle reschedule(nonblocking_queue *queue, queue_handle handle, pkey_t timestamp)
+{
+	queue_handle res = { NULL, 0 };
+	void *payload;
+	bool marked;
+
+	if(handle.node->flags & NODE_INTRUSIVE)
+		return res;
+
+	// once marked, the old node may be reclaimed by the thread which disconnects it
+	critical_enter();
+	payload = handle.node->payload;
+	marked = mark_handle(handle);
+	critical_exit();
+	if(!marked)
+		return res;
+
+	res.node = node_malloc(payload, timestamp);
+	res.generation = res.node->flags & ~NODE_KIND;
+	link_node(queue, res.node);
+	count_events(queue, -1);
+	return res;
+}
+
+/// Tells whether a node is to be removed by cancel_after
+#define to_annihilate(node, timestamp, match, arg)\
+		((node)->timestamp > (timestamp) && ((match) == NULL || (match)((node)->payload, (arg))))
+
+/**
+ * This function marks the live nodes of a bucket which follow a timestamp and match a predicate.
+ * The nodes are not disconnected: the next search or dequeue which meets them does it.
+ *
+ * @param queue the queue that contains the bucket
+ * @param head the head of the bucket
+ * @param timestamp the nodes with a greater timestamp are candidates
+ * @param match the predicate on the payload, NULL to match any node
+ * @param arg the second argument of the predicate
+ *
+ * @return the number of nodes marked by the caller
+ */
+static unsigned int cancel_bucket(nonblocking_queue *queue, bucket_node *head, pkey_t timestamp,
+		bool (*match)(void*, void*), void *arg)
+{
+	list_walk walk;
+	bucket_node *node, *next, *tail;
+	unsigned int res = 0;
+	tail = queue->tail;
+
+try_again:
+	walk_begin(&walk, head, false);
+
+	while(walk.node != tail)
+	{
+		if(!walk_reached(&walk))
+			goto try_again;
+
+		node = walk.node;
+		next = node->next;
+		if(!is_marked(next) && to_annihilate(node, timestamp, match, arg) && mark_node(node))
+		{
+			res++;
+			next = node->next;
+		}
+		walk_step(&walk, next);
+	}
+
+	return res;
+}
+
+/**
+ * This function marks the nodes of the future list which follow a timestamp and match a predicate.
+ * The traversal stops if an expansion marks the head of the list, since its nodes are being moved.
+ *
+ * @param queue the interested queue
+ * @param future the head of the future list, protected by the caller
+ * @param timestamp the nodes with a greater timestamp are candidates
+ * @param match the predicate on the payload, NULL to match any node
+ * @param arg the second argument of the predicate
+ *
+ * @return the number of nodes marked by the caller
+ */
+static unsigned int cancel_future(nonblocking_queue *queue, bucket_node *future, pkey_t timestamp,
+		bool (*match)(void*, void*), void *arg)
+{
+	list_walk walk;
+	bucket_node *node, *next, *tail;
+	unsigned int res = 0;
+	tail = queue->tail;
+
+	walk_begin(&walk, future, true);
+	if(is_marked(walk.node))
+		return 0;
+
+	while(walk.node != tail)
+	{
+		if(!walk_reached(&walk))
+			return res;
+
+		node = walk.node;
+		next = node->next;
+		if(!is_marked(next) && to_annihilate(node, timestamp, match, arg) && mark_node(node))
+		{
+			res++;
+			next = node->next;
+		}
+		walk_step(&walk, next);
+	}
+
+	return res;
+}
+
+/**
+ * This function removes in a single pass every pending event with a timestamp greater than a given one
+ * whose payload matches a predicate, e.g. the events of a sender being rolled back.
+ * The buckets from the one of the timestamp to the end of the hashtable and the future list are
+ * scanned; the nodes are marked as cancel does, thus enqueue and dequeue can run concurrently.
+ * An expansion met during the pass is completed by the caller, and the buckets it adds are scanned too.
+ * The events enqueued concurrently with the pass may survive it, as well as an event moved by
+ * another thread at the very end of an expansion.
+ *
+ * @param queue the interested queue
+ * @param timestamp the events with a greater timestamp are candidates
+ * @param match the predicate, invoked with the payload of a candidate and arg; NULL to remove all of them
+ * @param arg the second argument of the predicate
+ *
+ * @return the number of events removed
+ *
+ */
+unsigned int cancel_after(nonblocking_queue *queue, pkey_t timestamp, bool (*match)(void *payload, void *arg), void *arg)
+{
+	bucket_node *future;
+	index_t index, size;
+	unsigned int res = 0;
+
+	critical_enter();
+	index = first_bucket_in_use(queue, bucket_index(queue, timestamp));
+	while(true)
+	{
+		size = queue->dequeue_size;
+		for(index = window_index(queue, index, size); index < size; index++)
+			res += cancel_bucket(queue, bucket_head_of(queue, index), timestamp, match, arg);
+
+		future = protected_read(HP_FUTURE, queue->future_list);
+		if(future->size == size)
+		{
+			res += cancel_future(queue, future, timestamp, match, arg);
+			future = protected_read(HP_FUTURE, queue->future_list);
+			if(future->size == size && queue->dequeue_size == size)
+				break;
+		}
+
+		// the events of the future list are being moved to new buckets
+		expand_array(queue, size);
+	}
+	critical_exit();
+
+	if(res != 0)
+		count_events(queue, -(long long) res);
+	return res;
+}
+
+/**
+ * This function reads the first live event of a bucket without modifying the bucket:
+ * the marked nodes met at its beginning are traversed, but not disconnected.
+ *
+ * @param queue the queue that contains the bucket
+ * @param head the head of the bucket
+ *
+ * @return the first unmarked node of the bucket, protected by a hazard pointer, or the tail
+ */
+static bucket_node* peek_bucket(nonblocking_queue *queue, bucket_node *head)
+{
+	list_walk walk;
+	bucket_node *next, *tail;
+	tail = queue->tail;
+
+try_again:
+	// the marked nodes which follow the first one can be disconnected only together with it
+	walk_begin(&walk, head, false);
+
+	while(walk.node != tail)
+	{
+		if(!walk_reached(&walk))
+			goto try_again;
+
+		next = walk.node->next;
+		if(!is_marked(next))
+			break;
+		walk_step(&walk, next);
+	}
+
+	return walk.node;
+}
+
+/**
+ * This function reads the smallest timestamp in the future list. The list is unsorted,
+ * but nodes are only pushed on it until an expansion marks its head, thus it can be
+ * traversed as long as the head is unmarked.
+ *
+ * @param queue the interested queue
+ * @param future the head of the future list, protected by the caller
+ * @param bound the value returned if an expansion is met
+ *
+ * @return the smallest timestamp in the future list, INFTY if it is empty
+ */
+static pkey_t peek_future(nonblocking_queue *queue, bucket_node *future, pkey_t bound)
+{
+	list_walk walk;
+	bucket_node *next, *tail;
+	pkey_t res = INFTY;
+	tail = queue->tail;
+
+	// a marked head means that the nodes are being moved to the hashtable
+	walk_begin(&walk, future, true);
+	if(is_marked(walk.node))
+		return bound;
+
+	while(walk.node != tail)
+	{
+		if(!walk_reached(&walk))
+			return bound;
+
+		// the marked nodes are cancelled
+		next = walk.node->next;
+		if(!is_marked(next) && walk.node->timestamp < res)
+			res = walk.node->timestamp;
+		walk_step(&walk, next);
+	}
+
+	return res;
+}
+
+/**
+ * This function returns the smallest timestamp in the queue without dequeuing it.
+ * No CAS is issued: the buckets are scanned from current, and the scan is repeated
+ * if current is moved back by a concurrent enqueue in the meanwhile.
+ * The future list is read only if the buckets are empty; during an expansion of the
+ * hashtable, the first timestamp that its events may have is returned.
+ *
+ * @param queue the interested queue
+ *
+ * @return the smallest timestamp in the queue, INFTY if the queue is empty
+ *
+ */
+pkey_t peek_min(nonblocking_queue *queue)
+{
+	bucket_node *first, *future;
+	current_t oldCurrent;
+	index_t index, size;
+	pkey_t res;
+
+	critical_enter();
+	do
+	{
+		oldCurrent = read_current(queue);
+		size = queue->dequeue_size;
+		res = INFTY;
+
+		index = first_bucket_in_use(queue, window_index(queue, current_index(oldCurrent), size));
+		for(; index < size && res == INFTY; index++)
+		{
+			first = peek_bucket(queue, bucket_head_of(queue, index));
+			if(first != queue->tail && !later_lap(queue, first, index))
+				res = first->timestamp;
+		}
+
+		if(res == INFTY)
+		{
+			future = protected_read(HP_FUTURE, queue->future_list);
+			res = peek_future(queue, future, bucket_start(queue, size - 1));
+		}
+	}
+	while(!same_current(queue, oldCurrent));
+	critical_exit();
+
+	return res;
+}
+
+/**
+ * This function estimates the number of events in the queue by summing the counters of the threads,
+ * without touching the buckets. The result is exact when no operation is in progress.
+ *
+ * @param queue the interested queue
+ *
+ * @return the number of events in the queue
+ *
+ */
+unsigned long long size_estimate(nonblocking_queue *queue)
+{
+	unsigned int i, threads = size_threads;
+	long long res = 0;
+
+	if(threads > QUEUE_MAX_THREADS)
+		threads = QUEUE_MAX_THREADS;
+
+	for(i = 0; i < threads; i++)
+		res += queue->sizes[i].count;
+
+	// the counters are read at different times, thus a dequeue may be seen without its enqueue
+	return res > 0 ? (unsigned long long) res : 0;
+}
+
+/**
+ * This function tells whether the queue is empty without touching the buckets,
+ * thus it can be polled by idle threads. The result is exact when no operation is in progress.
+ *
+ * @param queue the interested queue
+ *
+ * @return true if the queue holds no event
+ *
+ */
+bool is_empty(nonblocking_queue *queue)
+{
+	return size_estimate(queue) == 0;
+}
+
+/**
+ * This function counts the events handed from an enqueuer to a dequeuer through the elimination array
+ *
+ * @param queue the interested queue
+ *
+ * @return the number of events which skipped the buckets, 0 if the elimination is off
+ *
+ */
+unsigned long long queue_eliminated(nonblocking_queue *queue)
+{
+	unsigned int i, threads = size_threads;
+	unsigned long long res = 0;
+
+	if(threads > QUEUE_MAX_THREADS)
+		threads = QUEUE_MAX_THREADS;
+
+	for(i = 0; i < threads; i++)
+		res += queue->sizes[i].eliminated;
+
+	return res;
+}
+
+/**
+ * This function returns a lower bound of the timestamps in the queue in constant time,
+ * namely the first timestamp covered by the bucket of current. The bound holds for the
+ * events whose enqueue has completed; with the ring calendar, the events which precede
+ * the window are not covered.
+ *
+ * @param queue the interested queue
+ *
+ * @return a value not greater than any timestamp in the queue
+ *
+ */
+pkey_t peek_lower_bound(nonblocking_queue *queue)
+{
+	return bucket_start(queue, current_index(queue->current));
+}
+
+/**
+ * This function moves forward the low watermark of prune, which never goes back
+ *
+ * @param queue the interested queue
+ * @param index the first bucket not yet pruned by the caller
+ *
+ * @return the previous watermark, or index if the watermark is already beyond it
+ */
+static inline index_t advance_watermark(nonblocking_queue *queue, index_t index)
+{
+	index_t old_index;
+
+	do
+	{
+		old_index = queue->starting_slot;
+		if(old_index >= index)
+			return index;
+	}
+	while(!CAS_size(&queue->starting_slot, old_index, index));
+
+	return old_index;
+}
+
+#if CALENDAR == CALENDAR_LINEAR
+#if RECLAMATION == RECLAMATION_EPOCH
+/// The heads of a retired segment are freed once the critical regions open when it was retired are closed
+#define segment_grace(queue, segment, heads)	(epoch_current() >= (queue)->retired_epoch[segment] + 2)
+#elif RECLAMATION == RECLAMATION_HAZARD
+/// The heads of a retired segment are freed once no hazard pointer protects them
+#define segment_grace(queue, segment, heads)	(!hazard_is_protected(heads))
+#else
+/// The heads of a retired segment are freed once the watermark is a whole segment past it,
+/// since the threads which may still read them work close to the watermark
+#define segment_grace(queue, segment, heads)\
+		((queue)->starting_slot >= segment_base((segment) + 2, (queue)->init_size))
+#endif
+
+/**
+ * This function retires a segment whose buckets are all before the watermark, so that
+ * bucket_head_of no longer leads to its heads. The heads are kept until free_retired_segments
+ * finds the grace period elapsed. The slot keeps SEGMENT_RETIRED, so that an expansion
+ * which stalled before the watermark moved cannot install new heads there.
+ *
+ * @param queue the interested queue
+ * @param segment the first-level index of the segment
+ * @param heads the heads read from the slot of the segment
+ */
+static void retire_segment(nonblocking_queue *queue, unsigned int segment, bucket_head *heads)
+{
+	if(!CAS_x86(
+			(volatile unsigned long long *) &queue->hashtable[segment],
+			(unsigned long long) heads,
+			(unsigned long long) SEGMENT_RETIRED
+			)
+		)
+		return;
+
+#if RECLAMATION == RECLAMATION_EPOCH
+	// read after the slot is retired, and stored before the heads are published
+	queue->retired_epoch[segment] = epoch_current();
+	__asm__ __volatile__("" ::: "memory");
+#endif
+	queue->retiring[segment] = heads;
+}
+
+#if RECLAMATION != RECLAMATION_PRUNE
+/**
+ * This function moves the events left in the buckets of a retired segment to the first
+ * bucket in use. They are linked by the enqueues which read the heads before the segment
+ * was retired; the grace period is over, thus no other thread walks these buckets.
+ *
+ * @param queue the interested queue
+ * @param heads the heads of the retired segment
+ * @param size the number of buckets in the segment
+ */
+static void drain_segment(nonblocking_queue *queue, bucket_head *heads, index_t size)
+{
+	bucket_node *node, *next, *tail = queue->tail;
+	index_t i, index;
+
+	for(i = 0; i < size; i++)
+		for(node = heads[i].next; node != tail; node = get_unmarked(next))
+		{
+			next = node->next;
+			if(is_marked(next))
+				connect_to_be_freed_list(queue, node, 1);
+			// a node cancelled meanwhile is handed to the reclamation scheme by insert
+			else if(insert(queue, node, true, &index))
+				flush_current(queue, index);
+		}
+}
+
+/**
+ * This function retires the segments whose buckets are all before the watermark and empty
+ *
+ * @param queue the interested queue
+ */
+static void retire_empty_segments(nonblocking_queue *queue)
+{
+	index_t watermark = queue->starting_slot;
+	index_t i, size;
+	unsigned int segment;
+	bucket_head *heads;
+	bucket_node *head;
+
+	for(segment = 0; segment < HASHTABLE_SEGMENTS - 1
+			&& segment_base(segment + 1, queue->init_size) <= watermark; segment++)
+	{
+		heads = queue->hashtable[segment];
+		if(heads == SEGMENT_RETIRED)
+			continue;
+		protect(HP_SEGMENT, heads);
+		if(heads != queue->hashtable[segment])
+			continue;
+
+		size = segment_base(segment + 1, queue->init_size) - segment_base(segment, queue->init_size);
+		for(i = 0; i < size; i++)
+		{
+			head = (bucket_node*) &heads[i];
+			unlink_marked_prefix(queue, head);
+			// a late event is still dequeued from here
+			if(head->next != queue->tail)
+				break;
+		}
+
+		if(i == size)
+			retire_segment(queue, segment, heads);
+	}
+}
+#endif
+
+/**
+ * This function frees the heads of the retired segments whose grace period has elapsed.
+ * The claim of the heads makes exactly one thread free them.
+ *
+ * @param queue the interested queue
+ */
+static void free_retired_segments(nonblocking_queue *queue)
+{
+	index_t watermark = queue->starting_slot;
+	unsigned int segment;
+	bucket_head *heads;
+
+#if RECLAMATION == RECLAMATION_EPOCH
+	// the caller is in a critical region, thus it advances the epoch at most once per call
+	epoch_try_advance();
+#endif
+
+	for(segment = 0; segment < HASHTABLE_SEGMENTS - 1
+			&& segment_base(segment + 1, queue->init_size) <= watermark; segment++)
+	{
+		heads = queue->retiring[segment];
+		if(heads == NULL || !segment_grace(queue, segment, heads)
+				|| !CAS_x86(
+					(volatile unsigned long long *) &queue->retiring[segment],
+					(unsigned long long) heads,
+					(unsigned long long) NULL
+					)
+			)
+			continue;
+
+#if RECLAMATION != RECLAMATION_PRUNE
+		drain_segment(queue, heads,
+				segment_base(segment + 1, queue->init_size) - segment_base(segment, queue->init_size));
+#endif
+		mm_std_free(heads);
+	}
+}
+#endif
+
+#if RECLAMATION == RECLAMATION_PRUNE
+/**
+ * This function accounts the buckets visited by a prune and retires the segments
+ * whose buckets have all been visited. The ranges claimed by prune are disjoint,
+ * thus exactly one thread completes a segment.
+ *
+ * @param queue the interested queue
+ * @param start_index the first bucket of the range visited by the caller
+ * @param end_index the first bucket after the range
+ */
+static void retire_segments(nonblocking_queue *queue, index_t start_index, index_t end_index)
+{
+	unsigned int segment = firstIndex(start_index, queue->init_size);
+	index_t last, visited, size;
+
+	for(; start_index < end_index; segment++)
+	{
+		last = segment_base(segment + 1, queue->init_size);
+		size = last - segment_base(segment, queue->init_size);
+		if(last > end_index)
+			last = end_index;
+
+		do
+			visited = queue->pruned[segment];
+		while(!CAS_size(&queue->pruned[segment], visited, visited + (last - start_index)));
+
+		if(visited + (last - start_index) == size)
+			retire_segment(queue, segment, queue->hashtable[segment]);
+		start_index = last;
+	}
 }
 
 /**
  * This function frees any node in the hashtable with a timestamp strictly less than a given threshold,
  * assuming that any thread does not hold any pointer related to any nodes
  * with timestamp lower than the threshold.
+ * Only the buckets after the low watermark left by the previous calls are visited,
+ * and a segment is retired once all its buckets have been visited. Its heads are freed
+ * by a later call, once the watermark is a whole segment past it.
+ * A relaxed queue is pruned no further than its lower bound.
  *
  * @author Romolo Marotta
  *
@@ -893,20 +3082,36 @@ bucket_node* dequeue(nonblocking_queue *queue)
  * @param timestamp the threshold such that any node with timestamp strictly less than it is removed and freed
  *
  */
-double prune(nonblocking_queue *queue, double timestamp)
+pkey_t prune(nonblocking_queue *queue, pkey_t timestamp)
 {
-	unsigned int end_index = hash(timestamp, queue->bucket_width);
-	unsigned int start_index = 0;//queue->starting_slot;
-	unsigned int i;
-	double committed = 0;
+	index_t end_index = bucket_index(queue, timestamp);
+	index_t start_index;
+	index_t i;
+	pkey_t committed = 0;
 	bucket_node *tmp, *to_remove_node;
 	bucket_node* tail = queue->tail;
 	bucket_node **tmp_previous = &to_free_pointers;
 	unsigned int counter;
+	pkey_t bound;
+
+	// a relaxed dequeue leaves events behind the ones it claims, but never before current
+	if(queue->spray_width > 1)
+	{
+		bound = peek_lower_bound(queue);
+		if(timestamp > bound)
+			end_index = bucket_index(queue, bound);
+	}
+
+	if(end_index > queue->dequeue_size)
+		end_index = queue->dequeue_size;
+
+	// the buckets before the threshold receive no more events, thus each range is claimed by one thread
+	start_index = advance_watermark(queue, end_index);
 
 	for (i = start_index; i < end_index; i++)
 	{
-		bucket_node* head = (bucket_node*)access_hashtable(queue->hashtable, i, queue->init_size, sizeof(bucket_node));
+		// the watermark is already past the claimed range
+		bucket_node* head = segment_head_of(queue, i);
 
 		to_remove_node = head->next;
 
@@ -922,23 +3127,27 @@ double prune(nonblocking_queue *queue, double timestamp)
 				tmp = to_remove_node->next;
 				if(!is_marked(tmp))
 				{
-					printf("Found a valid node during prune A @ %u.\n", i);
-					printf("Node %.10f, counter %u, index %u\n", to_remove_node->timestamp, to_remove_node->counter, hash(to_remove_node->timestamp, queue->bucket_width));
+					printf("Found a valid node during prune A @ %llu.\n", (unsigned long long) i);
+					printf("Node %.10f, counter %u, index %llu\n", (double) to_remove_node->timestamp, to_remove_node->counter,
+							(unsigned long long) bucket_index(queue, to_remove_node->timestamp));
 					error("Found a valid node during prune A.\n");
 				}
 				tmp = get_unmarked(tmp);
-				mm_free(to_remove_node);
+				release_node(queue, to_remove_node);
 				to_remove_node = tmp;
 			}
 		}
 	}
 
+	retire_segments(queue, start_index, end_index);
+	free_retired_segments(queue);
+
 	while(*tmp_previous != NULL)
 	{
 		to_remove_node = *tmp_previous;
 		if(
 				//queue == to_remove_node->queue &&
-				hash(to_remove_node->timestamp, queue->bucket_width) < end_index
+				bucket_index(queue, to_remove_node->timestamp) < end_index
 		)
 		{
 			*tmp_previous = (bucket_node*)(to_remove_node->payload);
@@ -952,7 +3161,7 @@ double prune(nonblocking_queue *queue, double timestamp)
 				if(!is_marked(to_remove_node))
 					error("Found a valid node during prune B.\n");
 				to_remove_node = get_unmarked(to_remove_node);
-				mm_free(tmp);
+				release_node(queue, tmp);
 			}
 		}
 		else
@@ -961,5 +3170,50 @@ double prune(nonblocking_queue *queue, double timestamp)
 
 	return committed;
 }
+#else
+/**
+ * This function disconnects the dequeued nodes left in the buckets preceding
+ * a given timestamp. It never removes a valid node, thus no assumption is made
+ * on the threshold: disconnected nodes are freed by the reclamation scheme.
+ * Only the buckets after the low watermark left by the previous calls are visited,
+ * and the segments before the watermark are retired once their buckets are empty.
+ * Their heads are freed by a later call, after a grace period of the reclamation scheme.
+ *
+ * @param queue the interested queue
+ * @param timestamp the threshold such that buckets strictly before it are tidied
+ *
+ * @return the timestamp up to which the buckets have been tidied
+ */
+pkey_t prune(nonblocking_queue *queue, pkey_t timestamp)
+{
+	index_t end_index = bucket_index(queue, timestamp);
+	index_t cur_index = current_index(queue->current);
+	index_t start_index = queue->starting_slot;
+	index_t i;
+
+	// buckets from current onward are still in use by dequeue
+	if(end_index > cur_index)
+		end_index = cur_index;
+
+#if CALENDAR == CALENDAR_RING
+	// the buckets before the window are reused by the current lap
+	start_index = window_index(queue, start_index, queue->dequeue_size);
+#endif
+
+	critical_enter();
+	for (i = start_index; i < end_index; i++)
+		unlink_marked_prefix(queue, bucket_head_of(queue, i));
+
+	// the events linked later behind the watermark are tidied by the dequeues which meet them
+	advance_watermark(queue, end_index);
+#if CALENDAR == CALENDAR_LINEAR
+	retire_empty_segments(queue);
+	free_retired_segments(queue);
+#endif
+	critical_exit();
+
+	return bucket_start(queue, queue->starting_slot);
+}
+#endif
 
 #pragma GCC diagnostic pop
@@ -28,10 +28,122 @@
 #define DATATYPES_NONBLOCKING_QUEUE_H_
 
 #include <stdbool.h>
+#include <stddef.h>
 #include <float.h>
+#include <limits.h>
 
+// Types of the keys
+#define KEY_DOUBLE	0	// double timestamps, the bucket index is computed with a division
+#define KEY_TICKS	1	// unsigned 64-bit ticks, the bucket width is a power of two and the index a shift
+
+#ifndef KEY_TYPE
+#define KEY_TYPE KEY_DOUBLE
+#endif
+
+#if KEY_TYPE == KEY_TICKS
+typedef unsigned long long pkey_t;
+#define INFTY ULLONG_MAX
+#define D_EQUAL(a,b) ((a) == (b))
+#else
+typedef double pkey_t;
 #define INFTY DBL_MAX
 #define D_EQUAL(a,b) (fabs((a) - (b)) < DBL_EPSILON)
+#endif
+
+// Memory reclamation schemes for the nodes disconnected from the queue
+#define RECLAMATION_PRUNE	0	// freed by prune() below a threshold computed by the application
+#define RECLAMATION_EPOCH	1	// freed after an epoch-based grace period
+#define RECLAMATION_HAZARD	2	// freed when no hazard pointer refers to them
+
+#ifndef RECLAMATION
+#define RECLAMATION RECLAMATION_EPOCH
+#endif
+
+// Padding policies of the nodes
+#define NODE_PADDING_NONE		0	// 32 bytes for any node
+#define NODE_PADDING_SENTINELS	1	// 32 bytes for events, a cache line for each sentinel
+#define NODE_PADDING_ALL		2	// the successor of any node lies alone in a cache line
+
+#ifndef NODE_PADDING
+#define NODE_PADDING NODE_PADDING_SENTINELS
+#endif
+
+// Padding policies of the bucket heads
+#define HEAD_PADDING_NONE		0	// eight heads per cache line
+#define HEAD_PADDING_LINE		1	// a cache line for each head
+
+#ifndef HEAD_PADDING
+#define HEAD_PADDING HEAD_PADDING_NONE
+#endif
+
+// Layouts of the calendar
+#define CALENDAR_LINEAR		0	// one bucket per index, the hashtable grows with the simulated time
+#define CALENDAR_RING		1	// the buckets of a fixed window are reused lap after lap
+
+#ifndef CALENDAR
+#define CALENDAR CALENDAR_LINEAR
+#endif
+
+#if CALENDAR == CALENDAR_RING && RECLAMATION == RECLAMATION_PRUNE
+#error "The ring calendar reuses the buckets, thus it cannot rely on prune to free the nodes"
+#endif
+
+// Width of the bucket indices
+#define INDEX_32	0	// current packs a 32-bit index with a 32-bit mark
+#define INDEX_64	1	// current packs a 64-bit index with a mark of 32 significant bits in a 64-bit field, updated with a 128-bit CAS
+
+#ifndef BUCKET_INDEX
+#define BUCKET_INDEX INDEX_32
+#endif
+
+#if BUCKET_INDEX == INDEX_64
+#if !defined(ARCH_X86_64)
+#error "64-bit bucket indices need a 128-bit CAS"
+#endif
+typedef unsigned long long index_t;
+#define HASHTABLE_SEGMENTS	64
+#else
+typedef unsigned int index_t;
+#define HASHTABLE_SEGMENTS	32
+#endif
+
+// Bucket width of the segments added by an expansion of the hashtable
+#define ADAPTIVE_WIDTH_OFF		0	// any segment keeps the width given to queue_init
+#define ADAPTIVE_WIDTH_ON		1	// each new segment takes a width estimated from the events per bucket
+
+#ifndef ADAPTIVE_WIDTH
+#if CALENDAR == CALENDAR_RING || KEY_TYPE == KEY_TICKS
+#define ADAPTIVE_WIDTH ADAPTIVE_WIDTH_OFF
+#else
+#define ADAPTIVE_WIDTH ADAPTIVE_WIDTH_ON
+#endif
+#endif
+
+#if CALENDAR == CALENDAR_RING && ADAPTIVE_WIDTH == ADAPTIVE_WIDTH_ON
+#error "The ring calendar has a single segment, thus its width cannot adapt"
+#endif
+
+#if KEY_TYPE == KEY_TICKS && ADAPTIVE_WIDTH == ADAPTIVE_WIDTH_ON
+#error "Integer keys need a fixed power-of-two bucket width"
+#endif
+
+#define WIDTH_TARGET_DENSITY	3.0		// events per bucket aimed by the adaptive width
+#define WIDTH_SAMPLE_PERIOD		1024	// dequeues of a thread between two samples of the density
+
+// Handover of the enqueued events which precede the minimum to the dequeuers which lost a race on it
+#define ELIMINATION_OFF		0	// any event goes through the buckets
+#define ELIMINATION_ON		1	// an elimination array pairs enqueuers and dequeuers
+
+#ifndef ELIMINATION
+#define ELIMINATION ELIMINATION_OFF
+#endif
+
+#define ELIMINATION_SLOTS		8		// slots of the elimination array
+#define ELIMINATION_SPINS		128		// reads of its slot by a dequeuer waiting for an event
+
+#define CACHE_LINE_SIZE 64
+
+#define QUEUE_MAX_THREADS		256		// Maximum number of threads which update the size of the queues
 
 extern __thread unsigned int  lid;
 
@@ -45,14 +157,125 @@ struct _bucket_node
 {
 	//char pad1[64];
 	bucket_node * volatile next;	// pointer to the successor
+#if NODE_PADDING == NODE_PADDING_ALL
 	char pad2[56];
+#endif
 	//void *queue;	// pointer to the successor
-	void *payload;  				// general payload
-	double timestamp;  				// key
+	pkey_t timestamp;  				// key
 	unsigned int counter; 			// used to resolve the conflict with same timestamp using a FIFO policy
+	unsigned int flags;				// NODE_* flags
+	union
+	{
+		void *payload;  			// general payload
+		index_t size;				// size of the hashtable, kept by the future_list and todo_list sentinels
+	};
 	//char pad3[36];					// actually used only to distinguish head nodes
 };
 
+#define NODE_INTRUSIVE	1			// the node is provided by the caller with enqueue_node
+#define NODE_SENTINEL	2			// the node is a sentinel allocated on its own cache line
+#define NODE_KIND		3			// mask of the flags above
+#define NODE_GENERATION	4			// the other bits of the flags count the retirements of the node
+
+/// Returns the struct which embeds a node enqueued with enqueue_node. After dequeue_node,
+/// the payload and counter of the node are no longer reliable, see dequeue_node
+#define node_container(node, type, member) ((type *)((char *)(node) - offsetof(type, member)))
+
+/**
+ *  Struct that define the handle of a pending event: its node and the generation of the node
+ *  when the event was linked. A node retired and reused for another event has a later generation,
+ *  thus the handle no longer matches it.
+ *  */
+typedef struct queue_handle queue_handle;
+struct queue_handle
+{
+	bucket_node *node;
+	unsigned int generation;
+};
+
+/// Returns the handle of the event linked by enqueue_node, valid until the event is dequeued
+#define node_handle(n)	((queue_handle) { (n), (n)->flags & ~NODE_KIND })
+
+/**
+ *  Struct that define the head of a bucket. It overlaps the first field of a bucket_node,
+ *  thus a head can be used as the left node of a search, while its timestamp is implied by its index.
+ *  Heads are allocated aligned to a cache line.
+ *  */
+typedef struct _bucket_head bucket_head;
+struct _bucket_head
+{
+	bucket_node * volatile next;	// pointer to the first node of the bucket
+#if HEAD_PADDING == HEAD_PADDING_LINE
+	char pad[CACHE_LINE_SIZE - sizeof(bucket_node*)];
+#endif
+};
+
+/**
+ *  Struct used to return a dequeued event by value
+ *  */
+typedef struct queue_entry queue_entry;
+struct queue_entry
+{
+	pkey_t timestamp;				// key
+	unsigned int counter;			// FIFO order among events with the same timestamp
+	void *payload;					// general payload
+};
+
+/**
+ *  Struct that define the share of the size of a queue kept by a thread,
+ *  namely the events it enqueued minus the ones it dequeued
+ *  */
+typedef struct size_counter size_counter;
+struct size_counter
+{
+	volatile long long count;
+	volatile unsigned long long eliminated;	// events received from an enqueuer through the elimination array
+	char pad[CACHE_LINE_SIZE - 2*sizeof(long long)];
+};
+
+/**
+ *  Struct that define the rank errors measured by a thread on the events it dequeued
+ *  from a relaxed queue, namely how many pending events preceded them
+ *  */
+typedef struct rank_counter rank_counter;
+struct rank_counter
+{
+	volatile unsigned long long samples;	// number of measured dequeues
+	volatile unsigned long long sum;		// sum of the measured rank errors
+	volatile unsigned long long max;		// largest measured rank error
+	char pad[CACHE_LINE_SIZE - 3*sizeof(unsigned long long)];
+};
+
+/**
+ *  Struct that define a slot of the elimination array. A dequeuer offers there the timestamp
+ *  of the minimum it failed to claim, and an enqueuer of an earlier event fills the slot
+ *  in place of linking a node.
+ *  */
+typedef struct elimination_slot elimination_slot;
+struct elimination_slot
+{
+	volatile unsigned long long state;	// number of the offer, shifted by 2, and its SLOT_* state
+	volatile pkey_t bound;				// the events preceding it can be handed over
+	volatile pkey_t timestamp;			// the event handed over
+	void * volatile payload;
+	char pad[CACHE_LINE_SIZE - sizeof(long long) - 2*sizeof(pkey_t) - sizeof(void*)];
+};
+
+#define SLOT_FREE		0	// no dequeuer is waiting
+#define SLOT_WAITING	1	// a dequeuer waits for an event preceding the bound
+#define SLOT_BUSY		2	// the owner of the slot is writing it
+#define SLOT_FILLED		3	// the event is ready to be taken by the dequeuer
+#define SLOT_STATE		3	// mask of the state
+
+// Slot of a segment retired by prune: its buckets are before the watermark, thus the first
+// bucket of the next segment in use stands for them, and its heads are freed after a grace period
+#define SEGMENT_RETIRED	((bucket_head*) 1)
+
+// Return values of dequeue_entry and dequeue_if_below
+#define QUEUE_OK	0
+#define QUEUE_EMPTY	1
+#define QUEUE_LATER	2	// the minimum does not precede the bound
+
 /**
  *
  */
@@ -61,34 +284,84 @@ typedef struct nonblocking_queue nonblocking_queue;
 struct nonblocking_queue
 {
 	//char pad1[64];
+#if BUCKET_INDEX == INDEX_64
+	volatile unsigned __int128 current;
+	char pad2[48];
+#else
 	volatile unsigned long long current;
 	char pad2[56];
+#endif
 	bucket_node * volatile future_list;
 	char pad3[56];
-	//volatile unsigned int starting_slot;
-	//char pad4[60];
+	volatile index_t starting_slot;	// low watermark of prune, the buckets before it are done
+	char pad4[CACHE_LINE_SIZE - sizeof(index_t)];
 	//volatile unsigned int ending_slot;
 	//char pad5[60];
-	volatile unsigned int dequeue_size;
+	volatile index_t dequeue_size;
 	//char pad6[60];
 	volatile unsigned int collaborative_todo_list;
-	char pad7[56];
+	char pad7[CACHE_LINE_SIZE - sizeof(index_t) - sizeof(unsigned int)];
 	bucket_node * volatile todo_list;
 	char pad8[56];
 
 	//volatile bucket_node * volatile hashtable[32];
-	bucket_node * volatile hashtable[32];
+	bucket_head * volatile hashtable[HASHTABLE_SEGMENTS];
 
 	char pad9[56];
-	double bucket_width;
+	pkey_t bucket_width;
+#if KEY_TYPE == KEY_TICKS
+	unsigned int bucket_shift;		// log2 of the bucket width
+#endif
 	bucket_node *tail;
 	unsigned int init_size;
+	void (*release)(void*);			// gives back the nodes provided with enqueue_node
+	size_counter *sizes;			// one counter for each thread, updated without atomic instructions
+	unsigned int spray_width;		// live nodes among which dequeue_entry claims a random one, at most 1 if strict
+	rank_counter *ranks;			// rank errors of the relaxed dequeues, one counter for each thread
+#if ADAPTIVE_WIDTH == ADAPTIVE_WIDTH_ON
+	volatile unsigned int segments;	// number of segments whose width is set
+	double volatile density;		// estimated events per bucket, 0 if not sampled
+	double volatile widths[HASHTABLE_SEGMENTS];	// bucket width of each segment of the hashtable
+	double starts[HASHTABLE_SEGMENTS];			// first timestamp covered by each segment
+#endif
+#if RECLAMATION == RECLAMATION_PRUNE
+	volatile index_t pruned[HASHTABLE_SEGMENTS];	// buckets of each segment visited by prune
+#endif
+#if CALENDAR == CALENDAR_LINEAR
+	bucket_head * volatile retiring[HASHTABLE_SEGMENTS];	// heads of the retired segments not yet freed
+#if RECLAMATION == RECLAMATION_EPOCH
+	volatile unsigned long long retired_epoch[HASHTABLE_SEGMENTS];	// epoch in which each segment was retired
+#endif
+#endif
+#if ELIMINATION == ELIMINATION_ON
+	elimination_slot elimination[ELIMINATION_SLOTS];
+#endif
 };
 
 
-extern bool enqueue(nonblocking_queue *queue, double timestamp, void* payload);
+extern bool enqueue(nonblocking_queue *queue, pkey_t timestamp, void* payload);
+extern bool enqueue_node(nonblocking_queue *queue, bucket_node *node, pkey_t timestamp, void* payload);
+extern queue_handle enqueue_handle(nonblocking_queue *queue, pkey_t timestamp, void* payload);
+extern unsigned int enqueue_batch(nonblocking_queue *queue, pkey_t *timestamps, void **payloads, unsigned int n);
+extern bucket_node* dequeue_node(nonblocking_queue *queue);
+extern void queue_set_release(nonblocking_queue *queue, void (*release)(void*));
 extern bucket_node* dequeue(nonblocking_queue *queue);
-extern double prune(nonblocking_queue *queue, double timestamp);
-extern nonblocking_queue* queue_init(unsigned int size, double bucket_width, unsigned int collaborative_todo_list);
+extern int dequeue_entry(nonblocking_queue *queue, queue_entry *entry);
+extern int dequeue_if_below(nonblocking_queue *queue, pkey_t bound, queue_entry *entry);
+extern unsigned int dequeue_many(nonblocking_queue *queue, queue_entry *entries, unsigned int k);
+extern unsigned int dequeue_window(nonblocking_queue *queue, pkey_t bound, queue_entry *entries, unsigned int max);
+extern bool cancel(nonblocking_queue *queue, queue_handle handle);
+extern queue_handle reschedule(nonblocking_queue *queue, queue_handle handle, pkey_t timestamp);
+extern unsigned int cancel_after(nonblocking_queue *queue, pkey_t timestamp, bool (*match)(void *payload, void *arg), void *arg);
+extern pkey_t peek_min(nonblocking_queue *queue);
+extern pkey_t peek_lower_bound(nonblocking_queue *queue);
+extern unsigned long long size_estimate(nonblocking_queue *queue);
+extern bool is_empty(nonblocking_queue *queue);
+extern pkey_t prune(nonblocking_queue *queue, pkey_t timestamp);
+extern nonblocking_queue* queue_init(unsigned int size, pkey_t bucket_width, unsigned int collaborative_todo_list);
+extern nonblocking_queue* queue_init_relaxed(unsigned int size, pkey_t bucket_width, unsigned int collaborative_todo_list, unsigned int threads);
+extern double queue_rank_error(nonblocking_queue *queue, unsigned long long *max);
+extern unsigned long long queue_eliminated(nonblocking_queue *queue);
+extern unsigned int queue_random(void);
 
 #endif /* DATATYPES_NONBLOCKING_QUEUE_H_ */
@@ -29,15 +29,30 @@
 #include <pthread.h>
 #include <stdarg.h>
 #include <sys/time.h>
+#include <sys/resource.h>
 
 #include "datatypes/nonblocking_queue.h"
 #include "datatypes/list.h"
 #include "datatypes/calqueue.h"
+#include "datatypes/multiqueue.h"
 
 #include "mm/myallocator.h"
 
+// The virtual time of the benchmark is a double, converted to the keys of the queue
+#if KEY_TYPE == KEY_TICKS
+#define TICKS_PER_UNIT	(1ULL << 20)
+#define to_key(time)	((pkey_t) ((time) * TICKS_PER_UNIT))
+#define from_key(key)	((double) (key) / TICKS_PER_UNIT)
+#define TIME_INFTY		DBL_MAX
+#else
+#define to_key(time)	(time)
+#define from_key(key)	(key)
+#define TIME_INFTY		INFTY
+#endif
+
 
 nonblocking_queue* nbqueue;
+multiqueue* mqueue;
 list(bucket_node) lqueue;
 
 int payload = 0;
@@ -150,16 +165,27 @@ void* process(void *arg)
 
 		if( random_num < (PROB_DEQUEUE))
 		{
-			double timestamp = INFTY;
+			double timestamp = TIME_INFTY;
 			unsigned int counter = 1;
-			void* free_pointer;
+			void* free_pointer = NULL;
 
-			if(DATASTRUCT == 'N')
+			if(DATASTRUCT == 'N' || DATASTRUCT == 'S')
 			{
-				bucket_node *new = dequeue(nbqueue);
-				free_pointer = new;
-				timestamp = new->timestamp;
-				counter = new->counter;
+				queue_entry new;
+				if(dequeue_entry(nbqueue, &new) == QUEUE_OK)
+				{
+					timestamp = from_key(new.timestamp);
+					counter = new.counter;
+				}
+			}
+			else if(DATASTRUCT == 'M')
+			{
+				queue_entry new;
+				if(multiqueue_dequeue(mqueue, &new) == QUEUE_OK)
+				{
+					timestamp = from_key(new.timestamp);
+					counter = new.counter;
+				}
 			}
 			else if(DATASTRUCT == 'L')
 			{
@@ -167,7 +193,7 @@ void* process(void *arg)
 				bucket_node *new = node_payload(lqueue,free_pointer);
 				if(free_pointer != NULL)
 				{
-					timestamp = new->timestamp;
+					timestamp = from_key(new->timestamp);
 					counter = new->counter;
 				}
 			}
@@ -181,7 +207,7 @@ void* process(void *arg)
 					counter = 1;
 				}
 			}
-			if(timestamp == INFTY)
+			if(timestamp == TIME_INFTY)
 			{
 				if( VERBOSE )
 					test_log(my_id, "%u-%d:%d\tDEQUEUE EMPTY\n", my_id, diff.tv_sec, diff.tv_usec);
@@ -225,7 +251,7 @@ void* process(void *arg)
 			}
 
 			if(free_pointer != NULL)
-				mm_free(free_pointer);
+				mm_std_free(free_pointer);
 		}
 		else
 		{
@@ -246,12 +272,14 @@ void* process(void *arg)
 			if(timestamp < 0.0)
 				timestamp = 0;
 
-			if(DATASTRUCT == 'N')
-				counter =	enqueue(nbqueue, timestamp, NULL);
+			if(DATASTRUCT == 'N' || DATASTRUCT == 'S')
+				counter =	enqueue(nbqueue, to_key(timestamp), NULL);
+			else if(DATASTRUCT == 'M')
+				counter =	multiqueue_enqueue(mqueue, to_key(timestamp), NULL);
 			else if(DATASTRUCT == 'L')
 			{
 				bucket_node node;
-				node.timestamp = timestamp;
+				node.timestamp = to_key(timestamp);
 				node.counter = 1;
 				list_insert(lqueue, timestamp, &node);
 			}
@@ -267,9 +295,11 @@ void* process(void *arg)
 
 		}
 
-		if( DATASTRUCT == 'N' && ops_count[my_id]%(PRUNE_PERIOD) == 0)
+#if RECLAMATION == RECLAMATION_PRUNE
+		// nodes are freed only below a threshold computed by the application
+		if( (DATASTRUCT == 'N' || DATASTRUCT == 'S' || DATASTRUCT == 'M') && ops_count[my_id]%(PRUNE_PERIOD) == 0)
 		{
-			double min = INFTY;
+			double min = TIME_INFTY;
 			unsigned int j =0;
 			for(;j<THREADS;j++)
 			{
@@ -277,16 +307,20 @@ void* process(void *arg)
 				if(tmp < min)
 					min = tmp;
 			}
-			prune(nbqueue, min*PRUNE_TRESHOLD);
+			if(DATASTRUCT == 'M')
+				multiqueue_prune(mqueue, to_key(min*PRUNE_TRESHOLD));
+			else
+				prune(nbqueue, to_key(min*PRUNE_TRESHOLD));
 
 			if( VERBOSE )
 				test_log(my_id, "%u-%d:%d\tPRUNE %.10f\n", my_id, (int)diff.tv_sec, (int)diff.tv_usec, min*PRUNE_TRESHOLD);
 
 		}
+#endif
 
 		if(my_id == 0 && ops_count[my_id]%(LOG_PERIOD) == 0 && LOG)
 		{
-			double min = INFTY;
+			double min = TIME_INFTY;
 			unsigned int j =0;
 			for(;j<THREADS;j++)
 			{
@@ -309,7 +343,7 @@ void* process(void *arg)
 
 	if(my_id == 0 && ops_count[my_id]%(LOG_PERIOD) == 0 && LOG)
 	{
-		double min = INFTY;
+		double min = TIME_INFTY;
 		unsigned int j =0;
 		for(;j<THREADS;j++)
 		{
@@ -325,16 +359,27 @@ void* process(void *arg)
 
 	do
 	{
-		double timestamp = INFTY;
+		double timestamp = TIME_INFTY;
 		unsigned int counter = 1;
-		void* free_pointer;
+		void* free_pointer = NULL;
 
-		if(DATASTRUCT == 'N')
+		if(DATASTRUCT == 'N' || DATASTRUCT == 'S')
 		{
-			bucket_node *new = dequeue(nbqueue);
-			free_pointer = new;
-			timestamp = new->timestamp;
-			counter = new->counter;
+			queue_entry new;
+			if(dequeue_entry(nbqueue, &new) == QUEUE_OK)
+			{
+				timestamp = from_key(new.timestamp);
+				counter = new.counter;
+			}
+		}
+		else if(DATASTRUCT == 'M')
+		{
+			queue_entry new;
+			if(multiqueue_dequeue(mqueue, &new) == QUEUE_OK)
+			{
+				timestamp = from_key(new.timestamp);
+				counter = new.counter;
+			}
 		}
 		else if(DATASTRUCT == 'L')
 		{
@@ -342,7 +387,7 @@ void* process(void *arg)
 			bucket_node *new = node_payload(lqueue,free_pointer);
 			if(free_pointer != NULL)
 			{
-				timestamp = new->timestamp;
+				timestamp = from_key(new->timestamp);
 				counter = new->counter;
 			}
 		}
@@ -356,7 +401,7 @@ void* process(void *arg)
 				counter = 1;
 			}
 		}
-		if(timestamp == INFTY)
+		if(timestamp == TIME_INFTY)
 		{
 			if( VERBOSE )
 				test_log(my_id, "%u-%d:%d\tDEQUEUE EMPTY\n", my_id, diff.tv_sec, diff.tv_usec);
@@ -380,7 +425,7 @@ void* process(void *arg)
 		}
 
 		if(free_pointer != NULL)
-			mm_free(free_pointer);
+			mm_std_free(free_pointer);
 	}while(EMPTY_QUEUE);
 
 	gettimeofday(&endTV, NULL);
@@ -398,7 +443,7 @@ void* process(void *arg)
 
 
 	ops[my_id] = n_dequeue - n_enqueue;
-	array[my_id] = INFTY;
+	array[my_id] = TIME_INFTY;
 
 	if( VERBOSE )
 	{
@@ -439,6 +484,22 @@ int main(int argc, char **argv)
 	SAFETY_CHECK = (unsigned int) strtol(argv[par++], (char **)NULL, 10);
 	EMPTY_QUEUE = (unsigned int) strtol(argv[par++], (char **)NULL, 10);
 
+#if KEY_TYPE == KEY_TICKS
+	// the list compares its keys as doubles
+	if(DATASTRUCT == 'L')
+	{
+		printf("The list is not available with integer keys\n");
+		exit(1);
+	}
+#endif
+
+	// the relaxed queues do not order the dequeues of different threads
+	if((DATASTRUCT == 'M' || DATASTRUCT == 'S') && SAFETY_CHECK)
+	{
+		printf("The safety check is not available with the relaxed queues\n");
+		exit(1);
+	}
+
 	id = (unsigned int*) malloc(THREADS*sizeof(unsigned int));
 	ops = (long long*) malloc(THREADS*sizeof(long long));
 	ops_count = (long long*) malloc(THREADS*sizeof(long long));
@@ -468,15 +529,24 @@ printf("B_WIDTH:%f,", BUCKET_WIDTH);
 printf("COLLABORATIVE_TODO_LIST:%u,", COLLABORATIVE_TODO_LIST);
 printf("SAFETY_CHECK:%u,", SAFETY_CHECK);
 printf("EMPTY_QUEUE:%u,", EMPTY_QUEUE);
+printf("RECLAMATION:%u,", RECLAMATION);
+printf("CALENDAR:%u,", CALENDAR);
+printf("BUCKET_INDEX:%u,", BUCKET_INDEX);
+printf("KEY_TYPE:%u,", KEY_TYPE);
+printf("ELIMINATION:%u,", ELIMINATION);
 
 
 	unsigned int i = 0;
 	pthread_t tid[THREADS];
 
-	mm_init(512, sizeof(bucket_node), false);
+	mm_init(512, sizeof(bucket_node), true);
 
 	if(DATASTRUCT == 'N')
-		nbqueue = queue_init(INIT_SIZE, BUCKET_WIDTH, COLLABORATIVE_TODO_LIST);
+		nbqueue = queue_init(INIT_SIZE, to_key(BUCKET_WIDTH), COLLABORATIVE_TODO_LIST);
+	else if(DATASTRUCT == 'S')
+		nbqueue = queue_init_relaxed(INIT_SIZE, to_key(BUCKET_WIDTH), COLLABORATIVE_TODO_LIST, THREADS);
+	else if(DATASTRUCT == 'M')
+		mqueue = multiqueue_init(THREADS, MQ_FACTOR, INIT_SIZE, to_key(BUCKET_WIDTH), COLLABORATIVE_TODO_LIST);
 	else if(DATASTRUCT == 'L')
 	{
 		lqueue = new_list(bucket_node);
@@ -520,9 +590,38 @@ printf("EMPTY_QUEUE:%u,", EMPTY_QUEUE);
 
 
 	printf("CHECK:%lld,", tmp);
+	if(DATASTRUCT == 'N')
+	{
+		printf("QUEUE_SIZE:%llu,", size_estimate(nbqueue));
+		printf("ELIMINATED:%llu,", queue_eliminated(nbqueue));
+	}
+	else if(DATASTRUCT == 'S')
+	{
+		unsigned long long rank_max;
+		double rank_avg = queue_rank_error(nbqueue, &rank_max);
+
+		printf("QUEUE_SIZE:%llu,", size_estimate(nbqueue));
+		printf("ELIMINATED:%llu,", queue_eliminated(nbqueue));
+		printf("RANK_ERR:%f,", rank_avg);
+		printf("RANK_MAX:%llu,", rank_max);
+	}
+	else if(DATASTRUCT == 'M')
+	{
+		unsigned long long rank_max;
+		double rank_avg = multiqueue_rank_error(mqueue, &rank_max);
+
+		printf("QUEUE_SIZE:%llu,", multiqueue_size(mqueue));
+		printf("MQ_FACTOR:%u,", MQ_FACTOR);
+		printf("RANK_ERR:%f,", rank_avg);
+		printf("RANK_MAX:%llu,", rank_max);
+	}
 	printf("MALLOC_T:%d.%d,", (int)mal.tv_sec, (int)mal.tv_usec);
 	printf("FREE_T:%d.%d,", (int)fre.tv_sec, (int)fre.tv_usec);
 
+	struct rusage usage;
+	getrusage(RUSAGE_SELF, &usage);
+	printf("PEAK_RSS_KB:%ld,", usage.ru_maxrss);
+
 	for(i=0;i<THREADS;i++)
 		printf("%d:%lld,", i,ops_count[i]);
 
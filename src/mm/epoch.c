@@ -0,0 +1,250 @@
+/*****************************************************************************
+*
+*	This file is part of NBQueue, a lock-free O(1) priority queue.
+*
+*   Copyright (C) 2015, Romolo Marotta
+*
+*   This program is free software: you can redistribute it and/or modify
+*   it under the terms of the GNU General Public License as published by
+*   the Free Software Foundation, either version 3 of the License, or
+*   (at your option) any later version.
+*
+*   This is distributed in the hope that it will be useful,
+*   but WITHOUT ANY WARRANTY; without even the implied warranty of
+*   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+*   GNU General Public License for more details.
+*
+*   You should have received a copy of the GNU General Public License
+*   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*
+******************************************************************************/
+/*
+ * epoch.c
+ *
+ *  Created on: Oct 17, 2026
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdbool.h>
+
+#include "../arch/atomic.h"
+#include "myallocator.h"
+#include "epoch.h"
+
+/**
+ *  Epoch-based reclamation.
+ *
+ *  Based on the scheme by K. Fraser. For further information see:
+ *  Keir Fraser, "Practical lock-freedom", PhD thesis, University of Cambridge, 2004
+ *
+ *  A thread announces the global epoch when it enters a critical region.
+ *  The global epoch advances only when every thread inside a critical region
+ *  has announced it, thus a pointer retired in epoch e cannot be referenced
+ *  by anyone once the global epoch reaches e+2.
+ *  Each thread keeps three limbo bags, one for each epoch still in flight.
+ */
+
+typedef struct epoch_record epoch_record;
+struct epoch_record
+{
+	volatile unsigned long long epoch;	// last epoch announced by the thread
+	volatile unsigned int active;		// 1 if the thread is in a critical region
+	char pad[52];
+};
+
+typedef struct limbo_entry limbo_entry;
+struct limbo_entry
+{
+	void *pointer;
+	void (*release)(void*);
+};
+
+typedef struct limbo_bag limbo_bag;
+struct limbo_bag
+{
+	limbo_entry *entries;
+	unsigned int size;
+	unsigned int capacity;
+	unsigned long long epoch;			// epoch of the pointers in the bag
+};
+
+static epoch_record records[EPOCH_MAX_THREADS] __attribute__((aligned(64)));
+static volatile unsigned long long global_epoch __attribute__((aligned(64))) = 0;
+static volatile unsigned int registered __attribute__((aligned(64))) = 0;
+
+__thread epoch_record *my_record = NULL;
+__thread unsigned int epoch_depth = 0;
+__thread unsigned int epoch_retired = 0;
+__thread limbo_bag limbo[3];
+
+/**
+ * This function frees every pointer in a limbo bag
+ *
+ * @param bag the bag to be emptied
+ */
+static void limbo_release(limbo_bag *bag)
+{
+	unsigned int i;
+
+	for(i = 0; i < bag->size; i++)
+		bag->entries[i].release(bag->entries[i].pointer);
+	bag->size = 0;
+}
+
+/**
+ * This function frees the bags of the calling thread which are at least two
+ * epochs older than the given one
+ *
+ * @param epoch the last observed global epoch
+ */
+static void limbo_collect(unsigned long long epoch)
+{
+	unsigned int i;
+
+	for(i = 0; i < 3; i++)
+		if(limbo[i].size != 0 && limbo[i].epoch + 2 <= epoch)
+			limbo_release(&limbo[i]);
+}
+
+/**
+ * This function registers the calling thread. It is implicitly called
+ * by the first epoch_enter of a thread.
+ */
+void epoch_register(void)
+{
+	unsigned int slot;
+
+	if(my_record != NULL)
+		return;
+
+	do
+		slot = registered;
+	while(!iCAS_x86(&registered, slot, slot+1));
+
+	if(slot >= EPOCH_MAX_THREADS)
+	{
+		printf("Too many threads registered for epoch-based reclamation\n");
+		exit(1);
+	}
+
+	my_record = &records[slot];
+	my_record->active = 0;
+	my_record->epoch = global_epoch;
+	memset(limbo, 0, sizeof(limbo));
+}
+
+/**
+ * This function tries to advance the global epoch. It succeeds only if every
+ * thread in a critical region has already announced the current one.
+ *
+ * @return true if the global epoch has been advanced by the caller
+ */
+bool epoch_try_advance(void)
+{
+	unsigned long long epoch = global_epoch;
+	unsigned int i, n = registered;
+
+	if(n > EPOCH_MAX_THREADS)
+		n = EPOCH_MAX_THREADS;
+
+	for(i = 0; i < n; i++)
+		if(records[i].active && records[i].epoch != epoch)
+			return false;
+
+	return CAS_x86(&global_epoch, epoch, epoch+1);
+}
+
+/**
+ * This function returns the global epoch. Anything disconnected before reading it
+ * cannot be referenced by anyone once the global epoch is two units greater.
+ *
+ * @return the global epoch
+ */
+unsigned long long epoch_current(void)
+{
+	return global_epoch;
+}
+
+/**
+ * This function opens a critical region: any pointer read from a shared
+ * structure is valid until the matching epoch_exit. Regions can be nested.
+ */
+void epoch_enter(void)
+{
+	unsigned long long epoch;
+
+	if(epoch_depth++ != 0)
+		return;
+
+	if(my_record == NULL)
+		epoch_register();
+
+	epoch = global_epoch;
+	my_record->epoch = epoch;
+	my_record->active = 1;
+	// the announcement must be visible before reading any shared pointer
+	__asm__ __volatile__("mfence" ::: "memory");
+
+	limbo_collect(epoch);
+}
+
+/**
+ * This function closes a critical region
+ */
+void epoch_exit(void)
+{
+	if(--epoch_depth != 0)
+		return;
+
+	__asm__ __volatile__("" ::: "memory");
+	my_record->active = 0;
+}
+
+/**
+ * This function defers the release of a pointer that has been disconnected
+ * from a shared structure until no thread can still hold a reference to it.
+ * It must be called inside a critical region.
+ *
+ * @param pointer the disconnected pointer
+ * @param release the function used to free the pointer
+ */
+void epoch_retire(void *pointer, void (*release)(void*))
+{
+	unsigned long long epoch = global_epoch;
+	limbo_bag *bag = &limbo[epoch % 3];
+
+	// the bag holds pointers retired at least three epochs ago
+	if(bag->epoch != epoch)
+	{
+		limbo_release(bag);
+		bag->epoch = epoch;
+	}
+
+	if(bag->size == bag->capacity)
+	{
+		unsigned int capacity = bag->capacity == 0 ? EPOCH_RETIRE_PERIOD : bag->capacity*2;
+		limbo_entry *entries = (limbo_entry*) mm_std_malloc(sizeof(limbo_entry) * capacity);
+
+		if(entries == NULL)
+		{
+			printf("No enough memory to allocate a limbo bag\n");
+			exit(1);
+		}
+		if(bag->entries != NULL)
+		{
+			memcpy(entries, bag->entries, sizeof(limbo_entry) * bag->size);
+			mm_std_free(bag->entries);
+		}
+		bag->entries = entries;
+		bag->capacity = capacity;
+	}
+
+	bag->entries[bag->size].pointer = pointer;
+	bag->entries[bag->size].release = release;
+	bag->size++;
+
+	if(++epoch_retired % EPOCH_RETIRE_PERIOD == 0 && epoch_try_advance())
+		limbo_collect(epoch+1);
+}
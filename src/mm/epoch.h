@@ -0,0 +1,42 @@
+/*****************************************************************************
+*
+*	This file is part of NBQueue, a lock-free O(1) priority queue.
+*
+*   Copyright (C) 2015, Romolo Marotta
+*
+*   This program is free software: you can redistribute it and/or modify
+*   it under the terms of the GNU General Public License as published by
+*   the Free Software Foundation, either version 3 of the License, or
+*   (at your option) any later version.
+*
+*   This is distributed in the hope that it will be useful,
+*   but WITHOUT ANY WARRANTY; without even the implied warranty of
+*   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+*   GNU General Public License for more details.
+*
+*   You should have received a copy of the GNU General Public License
+*   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*
+******************************************************************************/
+/*
+ * epoch.h
+ *
+ *  Created on: Oct 17, 2026
+ */
+
+#ifndef MM_EPOCH_H_
+#define MM_EPOCH_H_
+
+#include <stdbool.h>
+
+#define EPOCH_MAX_THREADS	256		// Maximum number of threads that can register
+#define EPOCH_RETIRE_PERIOD	64		// Number of retired pointers between two attempts to advance the epoch
+
+void epoch_register(void);
+void epoch_enter(void);
+void epoch_exit(void);
+void epoch_retire(void *pointer, void (*release)(void*));
+bool epoch_try_advance(void);
+unsigned long long epoch_current(void);
+
+#endif /* MM_EPOCH_H_ */
@@ -0,0 +1,200 @@
+/*****************************************************************************
+*
+*	This file is part of NBQueue, a lock-free O(1) priority queue.
+*
+*   Copyright (C) 2015, Romolo Marotta
+*
+*   This program is free software: you can redistribute it and/or modify
+*   it under the terms of the GNU General Public License as published by
+*   the Free Software Foundation, either version 3 of the License, or
+*   (at your option) any later version.
+*
+*   This is distributed in the hope that it will be useful,
+*   but WITHOUT ANY WARRANTY; without even the implied warranty of
+*   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+*   GNU General Public License for more details.
+*
+*   You should have received a copy of the GNU General Public License
+*   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*
+******************************************************************************/
+/*
+ * hazard.c
+ *
+ *  Created on: Oct 17, 2026
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdbool.h>
+
+#include "../arch/atomic.h"
+#include "myallocator.h"
+#include "hazard.h"
+
+/**
+ *  Hazard pointers.
+ *
+ *  Based on the scheme by Maged M. Michael. For further information see:
+ *  Maged M. Michael, "Hazard Pointers: Safe Memory Reclamation for Lock-Free Objects"
+ *  IEEE Transactions on Parallel and Distributed Systems, 2004
+ *
+ *  A retired pointer is freed only when no hazard pointer refers to it.
+ *  A thread scans the hazard pointers once its retired list is twice as long as
+ *  the number of hazard pointers, thus each thread holds at most O(threads)
+ *  retired pointers, even when another thread stalls.
+ */
+
+typedef struct hazard_record hazard_record;
+struct hazard_record
+{
+	void * volatile pointers[HAZARD_PER_THREAD];
+	char pad[64 - HAZARD_PER_THREAD*sizeof(void*)];
+};
+
+typedef struct retired_entry retired_entry;
+struct retired_entry
+{
+	void *pointer;
+	void (*release)(void*);
+};
+
+static hazard_record records[HAZARD_MAX_THREADS] __attribute__((aligned(64)));
+static volatile unsigned int registered __attribute__((aligned(64))) = 0;
+
+__thread void * volatile *my_hazards = NULL;
+__thread retired_entry *retired = NULL;
+__thread unsigned int retired_size = 0;
+__thread unsigned int retired_capacity = 0;
+__thread void **hazard_snapshot = NULL;
+
+static int compare_pointers(const void *a, const void *b)
+{
+	unsigned long long pa = (unsigned long long) *(void* const*)a;
+	unsigned long long pb = (unsigned long long) *(void* const*)b;
+
+	return (pa > pb) - (pa < pb);
+}
+
+/**
+ * This function registers the calling thread. It is implicitly called
+ * the first time a thread protects or retires a pointer.
+ */
+void hazard_register(void)
+{
+	unsigned int slot;
+
+	if(my_hazards != NULL)
+		return;
+
+	do
+		slot = registered;
+	while(!iCAS_x86(&registered, slot, slot+1));
+
+	if(slot >= HAZARD_MAX_THREADS)
+	{
+		printf("Too many threads registered for hazard pointers\n");
+		exit(1);
+	}
+
+	hazard_snapshot = (void**) mm_std_malloc(sizeof(void*) * HAZARD_MAX_THREADS * HAZARD_PER_THREAD);
+	retired_capacity = 2 * HAZARD_MAX_THREADS * HAZARD_PER_THREAD;
+	retired = (retired_entry*) mm_std_malloc(sizeof(retired_entry) * retired_capacity);
+	if(hazard_snapshot == NULL || retired == NULL)
+	{
+		printf("No enough memory to register a thread for hazard pointers\n");
+		exit(1);
+	}
+	my_hazards = records[slot].pointers;
+}
+
+/**
+ * This function clears every hazard pointer of the calling thread
+ */
+void hazard_clear_all(void)
+{
+	unsigned int i;
+
+	if(my_hazards == NULL)
+		return;
+
+	__asm__ __volatile__("" ::: "memory");
+	for(i = 0; i < HAZARD_PER_THREAD; i++)
+		my_hazards[i] = NULL;
+}
+
+/**
+ * This function frees every retired pointer which is not protected
+ * by any hazard pointer
+ */
+static void hazard_scan(void)
+{
+	unsigned int i, j, n = registered, snapshot_size = 0, kept = 0;
+	void *pointer;
+
+	if(n > HAZARD_MAX_THREADS)
+		n = HAZARD_MAX_THREADS;
+
+	for(i = 0; i < n; i++)
+		for(j = 0; j < HAZARD_PER_THREAD; j++)
+			if((pointer = records[i].pointers[j]) != NULL)
+				hazard_snapshot[snapshot_size++] = pointer;
+
+	qsort(hazard_snapshot, snapshot_size, sizeof(void*), compare_pointers);
+
+	for(i = 0; i < retired_size; i++)
+	{
+		if(bsearch(&retired[i].pointer, hazard_snapshot, snapshot_size, sizeof(void*), compare_pointers) != NULL)
+			retired[kept++] = retired[i];
+		else
+			retired[i].release(retired[i].pointer);
+	}
+	retired_size = kept;
+}
+
+/**
+ * This function tells whether a hazard pointer of any thread refers to a pointer.
+ * A pointer which is no longer reachable cannot be protected anew once it is found free.
+ *
+ * @param pointer the pointer to be looked up
+ *
+ * @return true if the pointer is protected
+ */
+bool hazard_is_protected(void *pointer)
+{
+	unsigned int i, j, n = registered;
+
+	if(n > HAZARD_MAX_THREADS)
+		n = HAZARD_MAX_THREADS;
+
+	for(i = 0; i < n; i++)
+		for(j = 0; j < HAZARD_PER_THREAD; j++)
+			if(records[i].pointers[j] == pointer)
+				return true;
+
+	return false;
+}
+
+/**
+ * This function defers the release of a pointer that has been disconnected
+ * from a shared structure until no hazard pointer refers to it.
+ *
+ * @param pointer the disconnected pointer
+ * @param release the function used to free the pointer
+ */
+void hazard_retire(void *pointer, void (*release)(void*))
+{
+	unsigned int threshold;
+
+	if(my_hazards == NULL)
+		hazard_register();
+
+	retired[retired_size].pointer = pointer;
+	retired[retired_size].release = release;
+	retired_size++;
+
+	threshold = 2 * registered * HAZARD_PER_THREAD;
+	if(retired_size >= threshold || retired_size == retired_capacity)
+		hazard_scan();
+}
@@ -0,0 +1,58 @@
+/*****************************************************************************
+*
+*	This file is part of NBQueue, a lock-free O(1) priority queue.
+*
+*   Copyright (C) 2015, Romolo Marotta
+*
+*   This program is free software: you can redistribute it and/or modify
+*   it under the terms of the GNU General Public License as published by
+*   the Free Software Foundation, either version 3 of the License, or
+*   (at your option) any later version.
+*
+*   This is distributed in the hope that it will be useful,
+*   but WITHOUT ANY WARRANTY; without even the implied warranty of
+*   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+*   GNU General Public License for more details.
+*
+*   You should have received a copy of the GNU General Public License
+*   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*
+******************************************************************************/
+/*
+ * hazard.h
+ *
+ *  Created on: Oct 17, 2026
+ */
+
+#ifndef MM_HAZARD_H_
+#define MM_HAZARD_H_
+
+#include <stdbool.h>
+
+#define HAZARD_MAX_THREADS	256		// Maximum number of threads that can register
+#define HAZARD_PER_THREAD	6		// Number of hazard pointers owned by each thread
+
+extern __thread void * volatile *my_hazards;
+
+void hazard_register(void);
+void hazard_retire(void *pointer, void (*release)(void*));
+void hazard_clear_all(void);
+bool hazard_is_protected(void *pointer);
+
+/**
+ * This function publishes a pointer that is going to be dereferenced.
+ * The caller has to check that the pointer is still reachable
+ * before using it.
+ *
+ * @param slot the index of the hazard pointer
+ * @param pointer the pointer to be protected
+ */
+static inline void hazard_protect(unsigned int slot, void *pointer)
+{
+	if(my_hazards == NULL)
+		hazard_register();
+	my_hazards[slot] = pointer;
+	__asm__ __volatile__("mfence" ::: "memory");
+}
+
+#endif /* MM_HAZARD_H_ */
@@ -32,12 +32,42 @@
 #include <stdbool.h>
 #include <sys/time.h>
 
+#include "../arch/atomic.h"
 #include "myallocator.h"
 
 
+/**
+ *  Per-thread pool of fixed-size slots. Slabs are aligned to their size, a power of two,
+ *  and the first slot of a slab is a header which stores the pool that carved it,
+ *  so that a slot freed by another thread can be given back to its owner.
+ *  The owner pops and pushes on the private free list without synchronisation,
+ *  while other threads push freed slots on the remote list with a CAS.
+ *  The owner detaches the whole remote list at once, thus the remote list
+ *  does not suffer from ABA.
+ */
+typedef struct mm_pool mm_pool;
+struct mm_pool
+{
+	void *local;					// private free list
+	unsigned long long slabs;		// number of slabs carved by this pool
+	char pad1[48];
+	void * volatile remote;			// slots freed by other threads
+	char pad2[56];
+};
+
+#define MM_HEADER_SIZE sizeof(unsigned long long*)
+#define MM_CACHE_LINE 64
+
+#define mm_slot_owner(pointer)\
+	( *( (mm_pool**) ( ((unsigned long long) (pointer)) & ~((unsigned long long) slab_size - 1) ) ) )
+
+#define mm_slot_next(pointer)\
+	( *( (void**) (pointer) ) )
+
 static bool active = false;
 static size_t block_size = 0;
 static size_t item_size = 0;
+static size_t slab_size = 0;		// bytes of a slab, header included
 volatile unsigned long long * volatile hashtable[32];
 volatile size_t free_index = 0;
 
@@ -45,6 +75,7 @@ __thread struct timeval mm_malloc_time;
 __thread struct timeval mm_free_time;
 __thread unsigned int mm_count_malloc = 0;
 __thread unsigned int mm_count_free = 0;
+__thread mm_pool *mm_local_pool = NULL;
 
 
 
@@ -59,8 +90,17 @@ void mm_init(size_t b_size, size_t i_size, bool activate)
 
 	if(activate)
 	{
-		item_size += sizeof(unsigned long long*);
-		block_size = b_size;
+		// slots of a power-of-two size are aligned to it, thus a 32-byte node
+		// never crosses a cache line, and the lowest bit is free for the mark
+		item_size = MM_HEADER_SIZE;
+		while(item_size < i_size)
+			item_size <<= 1;
+
+		// the header takes the first slot of a slab
+		slab_size = item_size;
+		while(slab_size < (b_size + 1) * item_size)
+			slab_size <<= 1;
+		block_size = slab_size / item_size - 1;
 	}
 	//printf("MY MALLOC %u %u %u %u\n", block_size, item_size, block_size*item_size, activate);
 
@@ -82,26 +122,163 @@ void mm_print_log()
 	printf("FREE time: %d:%d, ops:%d\n",   (int)mm_free_time.tv_sec, (int)mm_free_time.tv_usec, mm_count_free);
 }
 
+/**
+ * This function creates the pool of the calling thread.
+ * A pool is never released, since other threads can still give back slots to it
+ * after its owner has terminated.
+ *
+ * @return the pool of the calling thread
+ */
+static mm_pool* mm_pool_create(void)
+{
+	mm_pool *pool = NULL;
+
+	if(posix_memalign((void**)&pool, MM_CACHE_LINE, sizeof(mm_pool)) != 0)
+	{
+		printf("No enough memory to allocate a pool\n");
+		exit(1);
+	}
+	pool->local = NULL;
+	pool->remote = NULL;
+	pool->slabs = 0;
+	mm_local_pool = pool;
+	return pool;
+}
+
+/**
+ * This function carves a new slab of block_size slots, which follow its header,
+ * and links them in the private free list of the given pool
+ *
+ * @param pool the pool of the calling thread
+ */
+static void mm_slab_create(mm_pool *pool)
+{
+	char *slab = NULL;
+	char *slot;
+	size_t i;
+
+	// the alignment lets mm_slot_owner find the header by masking the address of a slot
+	if(posix_memalign((void**)&slab, slab_size, slab_size) != 0)
+	{
+		printf("No enough memory to allocate a slab\n");
+		exit(1);
+	}
+	*((mm_pool**) slab) = pool;
+
+	// link slots backward, so that the first slot of the slab is returned first
+	for(i = block_size; i > 0; i--)
+	{
+		slot = slab + i*item_size;
+		mm_slot_next(slot) = pool->local;
+		pool->local = slot;
+	}
+	pool->slabs++;
+}
+
+/**
+ * This function returns a slot to the calling thread. The fast path pops the
+ * private free list, then the slots given back by other threads are collected,
+ * and only when both are empty a new slab is requested to libc.
+ *
+ * @return a pointer to a slot of item_size bytes
+ */
+static inline void* mm_pool_malloc(void)
+{
+	mm_pool *pool = mm_local_pool;
+	void *res;
+
+	if(pool == NULL)
+		pool = mm_pool_create();
+
+	res = pool->local;
+	if(res == NULL)
+	{
+		// detach the whole remote list
+		do
+			res = pool->remote;
+		while(res != NULL && !CAS_x86(
+					(volatile unsigned long long *)&(pool->remote),
+					(unsigned long long) res,
+					(unsigned long long) NULL
+					)
+				);
+
+		if(res == NULL)
+		{
+			mm_slab_create(pool);
+			res = pool->local;
+		}
+	}
+
+	pool->local = mm_slot_next(res);
+	return res;
+}
+
+/**
+ * This function gives back a slot to the pool that carved it.
+ *
+ * @param pointer the slot to be released
+ */
+static inline void mm_pool_free(void *pointer)
+{
+	mm_pool *owner = mm_slot_owner(pointer);
+	void *head;
+
+	if(owner == mm_local_pool)
+	{
+		mm_slot_next(pointer) = owner->local;
+		owner->local = pointer;
+		return;
+	}
+
+	do
+	{
+		head = owner->remote;
+		mm_slot_next(pointer) = head;
+	}
+	while(!CAS_x86(
+			(volatile unsigned long long *)&(owner->remote),
+			(unsigned long long) head,
+			(unsigned long long) pointer
+			)
+		);
+}
+
 void* mm_malloc(void)
 {
+		void* res;
+#if MM_TIMING
 		struct timeval startTV,endTV,diff;
 		gettimeofday(&startTV, NULL);
-		void* res = malloc(item_size*block_size);
+#endif
+		if(active)
+			res = mm_pool_malloc();
+		else
+			res = malloc(item_size*block_size);
+#if MM_TIMING
 		gettimeofday(&endTV, NULL);
 		timersub(&endTV, &startTV, &diff);
 		timeradd(&diff, &mm_malloc_time, &mm_malloc_time);
+#endif
 		mm_count_malloc++;
 		return res;
 }
 
 void mm_free(void* pointer)
 {
+#if MM_TIMING
 		struct timeval startTV,endTV,diff;
 		gettimeofday(&startTV, NULL);
-		free(pointer);
+#endif
+		if(!active)
+			free(pointer);
+		else if(pointer != NULL)
+			mm_pool_free(pointer);
+#if MM_TIMING
 		gettimeofday(&endTV, NULL);
 		timersub(&endTV, &startTV, &diff);
 		timeradd(&diff, &mm_free_time, &mm_free_time);
+#endif
 		mm_count_free++;
 		return;
 }
@@ -110,6 +287,15 @@ void* rsalloc(size_t size){ return malloc(size); }
 
 void* mm_std_malloc(size_t size){ return malloc(size); }
 
+void* mm_std_aligned_malloc(size_t alignment, size_t size)
+{
+	void *res = NULL;
+
+	if(posix_memalign(&res, alignment, size) != 0)
+		return NULL;
+	return res;
+}
+
 void mm_std_free(void* pointer){ free(pointer); }
 
 void rsfree(void* pointer){ free(pointer); }
@@ -32,10 +32,17 @@
 #include <sys/time.h>
 #include <stddef.h>
 
+// Time spent in mm_malloc and mm_free, measured with two gettimeofday per call.
+// The measure costs far more than the pool itself, thus it is off unless requested.
+#ifndef MM_TIMING
+#define MM_TIMING 0
+#endif
+
 void  mm_init(size_t, size_t, bool);
 void* mm_malloc(void);
 void  mm_free(void*);
 void* mm_std_malloc(size_t size);
+void* mm_std_aligned_malloc(size_t alignment, size_t size);
 void* rsalloc(size_t size);
 void  mm_std_free(void* pointer);
 void  rsfree(void* pointer);
@@ -0,0 +1,108 @@
+/*****************************************************************************
+*
+*	This file is part of NBQueue, a lock-free O(1) priority queue.
+*
+*   Copyright (C) 2015, Romolo Marotta
+*
+*   This program is free software: you can redistribute it and/or modify
+*   it under the terms of the GNU General Public License as published by
+*   the Free Software Foundation, either version 3 of the License, or
+*   (at your option) any later version.
+*
+*   This is distributed in the hope that it will be useful,
+*   but WITHOUT ANY WARRANTY; without even the implied warranty of
+*   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+*   GNU General Public License for more details.
+*
+*   You should have received a copy of the GNU General Public License
+*   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*
+******************************************************************************/
+/*
+ * cancel_after.c
+ *
+ *  Checks that cancel_after removes exactly the matching events with a timestamp
+ *  strictly greater than the given one, in the hashtable and in the future list,
+ *  and that its count agrees with the events left in the queue.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+
+#include "datatypes/nonblocking_queue.h"
+#include "mm/myallocator.h"
+
+#define EVENTS		90
+#define SENDERS		3
+#define THRESHOLD	10
+
+// the payload of an event is its sender
+static bool same_sender(void *payload, void *arg)
+{
+	return payload == arg;
+}
+
+int main(void)
+{
+	nonblocking_queue *queue;
+	queue_entry entry;
+	unsigned int i, expected = 0, removed, left = 0, errors = 0;
+	void *rolled_back = (void*) (uintptr_t) 2;
+
+	mm_init(512, sizeof(bucket_node), true);
+	queue = queue_init(16, (pkey_t) 1, 1);
+
+	// the later events are beyond the hashtable
+	for(i = 0; i < EVENTS; i++)
+	{
+		enqueue(queue, (pkey_t) (i / SENDERS), (void*) (uintptr_t) (i % SENDERS + 1));
+		expected += i / SENDERS > THRESHOLD && (void*) (uintptr_t) (i % SENDERS + 1) == rolled_back;
+	}
+
+	removed = cancel_after(queue, (pkey_t) THRESHOLD, same_sender, rolled_back);
+	if(removed != expected)
+	{
+		printf("cancel_after removed %u events instead of %u\n", removed, expected);
+		errors++;
+	}
+	if(size_estimate(queue) != EVENTS - expected)
+	{
+		printf("size_estimate is %llu instead of %u\n", size_estimate(queue), EVENTS - expected);
+		errors++;
+	}
+	if(cancel_after(queue, (pkey_t) THRESHOLD, same_sender, rolled_back) != 0)
+	{
+		printf("A second cancel_after removed some events\n");
+		errors++;
+	}
+
+	while(dequeue_entry(queue, &entry) == QUEUE_OK)
+	{
+		if(entry.payload == rolled_back && entry.timestamp > (pkey_t) THRESHOLD)
+		{
+			printf("Event %f of the rolled back sender survived cancel_after\n", (double) entry.timestamp);
+			errors++;
+		}
+		left++;
+	}
+	if(left != EVENTS - expected)
+	{
+		printf("%u events left instead of %u\n", left, EVENTS - expected);
+		errors++;
+	}
+
+	// without a predicate every later event is removed
+	for(i = 0; i < EVENTS; i++)
+		enqueue(queue, (pkey_t) (i / SENDERS), NULL);
+	removed = cancel_after(queue, (pkey_t) THRESHOLD, NULL, NULL);
+	if(removed != EVENTS - (THRESHOLD + 1) * SENDERS || peek_min(queue) != (pkey_t) 0)
+	{
+		printf("cancel_after without a predicate removed %u events instead of %d\n",
+				removed, EVENTS - (THRESHOLD + 1) * SENDERS);
+		errors++;
+	}
+
+	printf("cancel_after: %s\n", errors == 0 ? "OK" : "FAILED");
+	return errors != 0;
+}
@@ -0,0 +1,87 @@
+/*****************************************************************************
+*
+*	This file is part of NBQueue, a lock-free O(1) priority queue.
+*
+*   Copyright (C) 2015, Romolo Marotta
+*
+*   This program is free software: you can redistribute it and/or modify
+*   it under the terms of the GNU General Public License as published by
+*   the Free Software Foundation, either version 3 of the License, or
+*   (at your option) any later version.
+*
+*   This is distributed in the hope that it will be useful,
+*   but WITHOUT ANY WARRANTY; without even the implied warranty of
+*   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+*   GNU General Public License for more details.
+*
+*   You should have received a copy of the GNU General Public License
+*   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*
+******************************************************************************/
+/*
+ * dequeue_if_below.c
+ *
+ *  Checks that dequeue_if_below dequeues the minimum only if it strictly precedes
+ *  the bound, reports the minimum otherwise, and leaves the queue untouched then.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "datatypes/nonblocking_queue.h"
+#include "mm/myallocator.h"
+
+static unsigned int errors = 0;
+
+// calls dequeue_if_below and checks the result and the timestamp returned
+static void check_below(nonblocking_queue *queue, pkey_t bound, int expected, pkey_t timestamp)
+{
+	queue_entry entry;
+	int res;
+
+	entry.timestamp = 0;
+	res = dequeue_if_below(queue, bound, &entry);
+
+	if(res != expected || (res != QUEUE_EMPTY && entry.timestamp != timestamp))
+	{
+		printf("dequeue_if_below(%f) returned %d with %f instead of %d with %f\n",
+				(double) bound, res, (double) entry.timestamp, expected, (double) timestamp);
+		errors++;
+	}
+}
+
+int main(void)
+{
+	nonblocking_queue *queue;
+
+	mm_init(512, sizeof(bucket_node), true);
+	queue = queue_init(16, (pkey_t) 1, 1);
+
+	check_below(queue, INFTY, QUEUE_EMPTY, 0);
+
+	enqueue(queue, (pkey_t) 3, NULL);
+	enqueue(queue, (pkey_t) 3, NULL);
+	enqueue(queue, (pkey_t) 8, NULL);
+	// beyond the hashtable
+	enqueue(queue, (pkey_t) 40, NULL);
+
+	// a bound equal to the minimum does not let it go
+	check_below(queue, (pkey_t) 3, QUEUE_LATER, (pkey_t) 3);
+	check_below(queue, (pkey_t) 0, QUEUE_LATER, (pkey_t) 3);
+	if(size_estimate(queue) != 4 || peek_min(queue) != (pkey_t) 3)
+	{
+		printf("A failed dequeue_if_below changed the queue\n");
+		errors++;
+	}
+
+	check_below(queue, (pkey_t) 4, QUEUE_OK, (pkey_t) 3);
+	check_below(queue, (pkey_t) 4, QUEUE_OK, (pkey_t) 3);
+	check_below(queue, (pkey_t) 4, QUEUE_LATER, (pkey_t) 8);
+	check_below(queue, (pkey_t) 9, QUEUE_OK, (pkey_t) 8);
+	check_below(queue, (pkey_t) 40, QUEUE_LATER, (pkey_t) 40);
+	check_below(queue, (pkey_t) 41, QUEUE_OK, (pkey_t) 40);
+	check_below(queue, INFTY, QUEUE_EMPTY, 0);
+
+	printf("dequeue_if_below: %s\n", errors == 0 ? "OK" : "FAILED");
+	return errors != 0;
+}
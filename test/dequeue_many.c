@@ -0,0 +1,92 @@
+/*****************************************************************************
+*
+*	This file is part of NBQueue, a lock-free O(1) priority queue.
+*
+*   Copyright (C) 2015, Romolo Marotta
+*
+*   This program is free software: you can redistribute it and/or modify
+*   it under the terms of the GNU General Public License as published by
+*   the Free Software Foundation, either version 3 of the License, or
+*   (at your option) any later version.
+*
+*   This is distributed in the hope that it will be useful,
+*   but WITHOUT ANY WARRANTY; without even the implied warranty of
+*   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+*   GNU General Public License for more details.
+*
+*   You should have received a copy of the GNU General Public License
+*   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*
+******************************************************************************/
+/*
+ * dequeue_many.c
+ *
+ *  Checks that dequeue_many returns at most k events per call, in timestamp order
+ *  across calls, and every event exactly once, when buckets hold several events.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+
+#include "datatypes/nonblocking_queue.h"
+#include "mm/myallocator.h"
+
+#define EVENTS		200
+#define PER_BUCKET	4		// events sharing a timestamp
+#define K			7
+
+int main(void)
+{
+	nonblocking_queue *queue;
+	queue_entry entries[K];
+	unsigned char seen[EVENTS] = {0};
+	unsigned int i, j, n, id, dequeued = 0, errors = 0;
+	pkey_t last = 0;
+
+	mm_init(512, sizeof(bucket_node), true);
+	queue = queue_init(16, (pkey_t) 1, 1);
+
+	// enqueued backwards, so that the order does not come from the insertions
+	for(i = EVENTS; i-- != 0;)
+		enqueue(queue, (pkey_t) (i / PER_BUCKET), (void*) (uintptr_t) (i + 1));
+
+	while((n = dequeue_many(queue, entries, K)) != 0)
+	{
+		if(n > K)
+		{
+			printf("dequeue_many returned %u events instead of at most %d\n", n, K);
+			errors++;
+			break;
+		}
+		for(j = 0; j < n; j++)
+		{
+			if(entries[j].timestamp < last)
+			{
+				printf("Event %f dequeued after %f\n", (double) entries[j].timestamp, (double) last);
+				errors++;
+			}
+			id = (unsigned int) (uintptr_t) entries[j].payload - 1;
+			if(id >= EVENTS || seen[id]++ != 0 || entries[j].timestamp != (pkey_t) (id / PER_BUCKET))
+			{
+				printf("Payload %u dequeued twice or with a wrong timestamp\n", id);
+				errors++;
+			}
+			last = entries[j].timestamp;
+		}
+		dequeued += n;
+	}
+	if(dequeued != EVENTS)
+	{
+		printf("%u events dequeued instead of %d\n", dequeued, EVENTS);
+		errors++;
+	}
+	if(dequeue_many(queue, entries, K) != 0 || !is_empty(queue))
+	{
+		printf("The queue is not empty after the last dequeue_many\n");
+		errors++;
+	}
+
+	printf("dequeue_many: %s\n", errors == 0 ? "OK" : "FAILED");
+	return errors != 0;
+}
@@ -0,0 +1,113 @@
+/*****************************************************************************
+*
+*	This file is part of NBQueue, a lock-free O(1) priority queue.
+*
+*   Copyright (C) 2015, Romolo Marotta
+*
+*   This program is free software: you can redistribute it and/or modify
+*   it under the terms of the GNU General Public License as published by
+*   the Free Software Foundation, either version 3 of the License, or
+*   (at your option) any later version.
+*
+*   This is distributed in the hope that it will be useful,
+*   but WITHOUT ANY WARRANTY; without even the implied warranty of
+*   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+*   GNU General Public License for more details.
+*
+*   You should have received a copy of the GNU General Public License
+*   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*
+******************************************************************************/
+/*
+ * dequeue_window.c
+ *
+ *  Checks that dequeue_window claims exactly the events strictly preceding the bound,
+ *  up to the maximum, in timestamp order, and leaves the following ones in place.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "datatypes/nonblocking_queue.h"
+#include "mm/myallocator.h"
+
+#define EVENTS		60
+#define PER_KEY		2
+#define MAX			100
+
+static unsigned int errors = 0;
+
+// calls dequeue_window and checks the number, the bound and the order of the events returned
+static void check_window(nonblocking_queue *queue, pkey_t bound, unsigned int max, unsigned int expected, pkey_t *last)
+{
+	queue_entry entries[MAX];
+	unsigned int i, n;
+
+	n = dequeue_window(queue, bound, entries, max);
+	if(n != expected)
+	{
+		printf("dequeue_window(%f, %u) returned %u events instead of %u\n", (double) bound, max, n, expected);
+		errors++;
+	}
+	for(i = 0; i < n && i < max; i++)
+	{
+		if(entries[i].timestamp >= bound || entries[i].timestamp < *last)
+		{
+			printf("Event %f dequeued by dequeue_window(%f) after %f\n",
+					(double) entries[i].timestamp, (double) bound, (double) *last);
+			errors++;
+		}
+		*last = entries[i].timestamp;
+	}
+}
+
+int main(void)
+{
+	nonblocking_queue *queue;
+	queue_entry entry;
+	unsigned int i, left = 0;
+	pkey_t last = 0;
+
+	mm_init(512, sizeof(bucket_node), true);
+	queue = queue_init(16, (pkey_t) 1, 1);
+
+	// the later keys are beyond the hashtable
+	for(i = 0; i < EVENTS; i++)
+		enqueue(queue, (pkey_t) (i / PER_KEY), NULL);
+
+	// no event precedes the minimum
+	check_window(queue, (pkey_t) 0, MAX, 0, &last);
+	if(peek_min(queue) != (pkey_t) 0)
+	{
+		printf("dequeue_window claimed an event not preceding the bound\n");
+		errors++;
+	}
+
+	check_window(queue, (pkey_t) 5, MAX, 5 * PER_KEY, &last);
+	// the maximum stops the claim in the middle of a key
+	check_window(queue, (pkey_t) 20, 3, 3, &last);
+	check_window(queue, (pkey_t) 20, MAX, 15 * PER_KEY - 3, &last);
+
+	if(peek_min(queue) != (pkey_t) 20)
+	{
+		printf("peek_min returned %f instead of 20 after the windows\n", (double) peek_min(queue));
+		errors++;
+	}
+	while(dequeue_entry(queue, &entry) == QUEUE_OK)
+	{
+		if(entry.timestamp < (pkey_t) 20)
+		{
+			printf("Event %f left behind by dequeue_window\n", (double) entry.timestamp);
+			errors++;
+		}
+		left++;
+	}
+	if(left != EVENTS - 20 * PER_KEY)
+	{
+		printf("%u events left instead of %d\n", left, EVENTS - 20 * PER_KEY);
+		errors++;
+	}
+
+	printf("dequeue_window: %s\n", errors == 0 ? "OK" : "FAILED");
+	return errors != 0;
+}
@@ -0,0 +1,100 @@
+/*****************************************************************************
+*
+*	This file is part of NBQueue, a lock-free O(1) priority queue.
+*
+*   Copyright (C) 2015, Romolo Marotta
+*
+*   This program is free software: you can redistribute it and/or modify
+*   it under the terms of the GNU General Public License as published by
+*   the Free Software Foundation, either version 3 of the License, or
+*   (at your option) any later version.
+*
+*   This is distributed in the hope that it will be useful,
+*   but WITHOUT ANY WARRANTY; without even the implied warranty of
+*   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+*   GNU General Public License for more details.
+*
+*   You should have received a copy of the GNU General Public License
+*   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*
+******************************************************************************/
+/*
+ * enqueue_batch.c
+ *
+ *  Checks that a batch of unsorted events, some sharing a timestamp and some beyond
+ *  the hashtable, is dequeued in timestamp order together with events enqueued one by one.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+
+#include "datatypes/nonblocking_queue.h"
+#include "mm/myallocator.h"
+
+#define BATCH		100
+#define KEYS		50		// each timestamp of the batch is shared by two events
+#define SINGLES		10
+
+int main(void)
+{
+	nonblocking_queue *queue;
+	queue_entry entry;
+	pkey_t timestamps[BATCH], last = 0;
+	void *payloads[BATCH];
+	unsigned char seen[BATCH + SINGLES] = {0};
+	unsigned int i, id, inserted, dequeued = 0, errors = 0;
+
+	mm_init(512, sizeof(bucket_node), true);
+	queue = queue_init(16, (pkey_t) 1, 1);
+
+	for(i = 0; i < SINGLES; i++)
+		enqueue(queue, (pkey_t) (5*i + 2), (void*) (uintptr_t) (BATCH + i + 1));
+
+	for(i = 0; i < BATCH; i++)
+	{
+		timestamps[i] = (pkey_t) ((37*i) % KEYS);
+		payloads[i] = (void*) (uintptr_t) (i + 1);
+	}
+	inserted = enqueue_batch(queue, timestamps, payloads, BATCH);
+	if(inserted > BATCH)
+	{
+		printf("enqueue_batch returned %u for %d events\n", inserted, BATCH);
+		errors++;
+	}
+	if(size_estimate(queue) != BATCH + SINGLES)
+	{
+		printf("size_estimate is %llu instead of %d\n", size_estimate(queue), BATCH + SINGLES);
+		errors++;
+	}
+
+	while(dequeue_entry(queue, &entry) == QUEUE_OK)
+	{
+		if(entry.timestamp < last)
+		{
+			printf("Event %f dequeued after %f\n", (double) entry.timestamp, (double) last);
+			errors++;
+		}
+		id = (unsigned int) (uintptr_t) entry.payload - 1;
+		if(id >= BATCH + SINGLES || seen[id]++ != 0)
+		{
+			printf("Payload %u dequeued twice or never enqueued\n", id);
+			errors++;
+		}
+		else if(entry.timestamp != (id < BATCH ? timestamps[id] : (pkey_t) (5*(id - BATCH) + 2)))
+		{
+			printf("Payload %u dequeued with timestamp %f\n", id, (double) entry.timestamp);
+			errors++;
+		}
+		last = entry.timestamp;
+		dequeued++;
+	}
+	if(dequeued != BATCH + SINGLES)
+	{
+		printf("%u events dequeued instead of %d\n", dequeued, BATCH + SINGLES);
+		errors++;
+	}
+
+	printf("enqueue_batch: %s\n", errors == 0 ? "OK" : "FAILED");
+	return errors != 0;
+}
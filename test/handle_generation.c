@@ -0,0 +1,99 @@
+/*****************************************************************************
+*
+*	This file is part of NBQueue, a lock-free O(1) priority queue.
+*
+*   Copyright (C) 2015, Romolo Marotta
+*
+*   This program is free software: you can redistribute it and/or modify
+*   it under the terms of the GNU General Public License as published by
+*   the Free Software Foundation, either version 3 of the License, or
+*   (at your option) any later version.
+*
+*   This is distributed in the hope that it will be useful,
+*   but WITHOUT ANY WARRANTY; without even the implied warranty of
+*   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+*   GNU General Public License for more details.
+*
+*   You should have received a copy of the GNU General Public License
+*   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*
+******************************************************************************/
+/*
+ * handle_generation.c
+ *
+ *  Checks that the handle of a dequeued event does not cancel the events which
+ *  reuse its node afterwards, once the reclamation scheme has freed it.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "datatypes/nonblocking_queue.h"
+#include "mm/myallocator.h"
+
+#define ROUNDS		64
+#define EVENTS		256
+
+int main(void)
+{
+	nonblocking_queue *queue;
+	queue_handle old[ROUNDS], handles[EVENTS];
+	queue_entry entry;
+	unsigned int i, j, k, reused = 0, errors = 0;
+	pkey_t now = 0;
+
+	mm_init(512, sizeof(bucket_node), true);
+	queue = queue_init(16, (pkey_t) 1, 1);
+
+	for(i = 0; i < ROUNDS; i++)
+	{
+		old[i] = enqueue_handle(queue, now++, NULL);
+		if(dequeue_entry(queue, &entry) != QUEUE_OK)
+			errors++;
+		if(cancel(queue, old[i]))
+		{
+			printf("A dequeued event has been cancelled\n");
+			errors++;
+		}
+#if RECLAMATION == RECLAMATION_PRUNE
+		prune(queue, now);
+#endif
+
+		// the freed nodes come back from the pool of this thread
+		for(j = 0; j < EVENTS; j++)
+			handles[j] = enqueue_handle(queue, now + (pkey_t) j, NULL);
+		for(j = 0; j < EVENTS; j++)
+		{
+			for(k = 0; k <= i; k++)
+			{
+				if(handles[j].node != old[k].node)
+					continue;
+				reused++;
+				if(cancel(queue, old[k]))
+				{
+					printf("A stale handle cancelled the event which reuses its node\n");
+					errors++;
+				}
+			}
+		}
+		for(j = 0; j < EVENTS; j++)
+		{
+			if(!cancel(queue, handles[j]))
+			{
+				printf("A pending event cannot be cancelled\n");
+				errors++;
+			}
+		}
+		while(dequeue_entry(queue, &entry) == QUEUE_OK)
+			now = entry.timestamp + 1;
+	}
+
+	if(reused == 0)
+	{
+		printf("No node has been reused\n");
+		errors++;
+	}
+
+	printf("handle_generation: %s\n", errors == 0 ? "OK" : "FAILED");
+	return errors != 0;
+}
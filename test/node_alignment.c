@@ -0,0 +1,75 @@
+/*****************************************************************************
+*
+*	This file is part of NBQueue, a lock-free O(1) priority queue.
+*
+*   Copyright (C) 2015, Romolo Marotta
+*
+*   This program is free software: you can redistribute it and/or modify
+*   it under the terms of the GNU General Public License as published by
+*   the Free Software Foundation, either version 3 of the License, or
+*   (at your option) any later version.
+*
+*   This is distributed in the hope that it will be useful,
+*   but WITHOUT ANY WARRANTY; without even the implied warranty of
+*   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+*   GNU General Public License for more details.
+*
+*   You should have received a copy of the GNU General Public License
+*   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*
+******************************************************************************/
+/*
+ * node_alignment.c
+ *
+ *  Checks that the pool of mm_malloc keeps every bucket_node within a single cache line,
+ *  and that slots freed by another thread go back to the pool which carved them.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <pthread.h>
+
+#include "datatypes/nonblocking_queue.h"
+#include "mm/myallocator.h"
+
+#define NODES	4096
+
+static void *nodes[NODES];
+
+static void* free_nodes(void *arg)
+{
+	unsigned int i;
+
+	for(i = 0; i < NODES; i++)
+		mm_free(nodes[i]);
+	return arg;
+}
+
+int main(void)
+{
+	unsigned long long address;
+	unsigned int i, j, errors = 0;
+	pthread_t tid;
+
+	mm_init(512, sizeof(bucket_node), true);
+
+	// the second round reuses the slots given back by the other thread
+	for(j = 0; j < 2; j++)
+	{
+		for(i = 0; i < NODES; i++)
+		{
+			nodes[i] = mm_malloc();
+			address = (unsigned long long) nodes[i];
+			if((address & 31) != 0 || (address & 63) + sizeof(bucket_node) > 64)
+			{
+				printf("Node %p is not aligned to 32 bytes\n", nodes[i]);
+				errors++;
+			}
+		}
+		pthread_create(&tid, NULL, free_nodes, NULL);
+		pthread_join(tid, NULL);
+	}
+
+	printf("node_alignment: %s\n", errors == 0 ? "OK" : "FAILED");
+	return errors != 0;
+}
@@ -0,0 +1,86 @@
+/*****************************************************************************
+*
+*	This file is part of NBQueue, a lock-free O(1) priority queue.
+*
+*   Copyright (C) 2015, Romolo Marotta
+*
+*   This program is free software: you can redistribute it and/or modify
+*   it under the terms of the GNU General Public License as published by
+*   the Free Software Foundation, either version 3 of the License, or
+*   (at your option) any later version.
+*
+*   This is distributed in the hope that it will be useful,
+*   but WITHOUT ANY WARRANTY; without even the implied warranty of
+*   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+*   GNU General Public License for more details.
+*
+*   You should have received a copy of the GNU General Public License
+*   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*
+******************************************************************************/
+/*
+ * peek_min.c
+ *
+ *  Checks that peek_min returns the minimum without removing it: in the future list,
+ *  after a late enqueue moves current back, and past a cancelled event.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "datatypes/nonblocking_queue.h"
+#include "mm/myallocator.h"
+
+static unsigned int errors = 0;
+
+// compares peek_min with the expected minimum
+static void check_peek(nonblocking_queue *queue, pkey_t expected, const char *when)
+{
+	pkey_t min = peek_min(queue);
+
+	if(min != expected)
+	{
+		printf("peek_min returned %f instead of %f %s\n", (double) min, (double) expected, when);
+		errors++;
+	}
+}
+
+int main(void)
+{
+	nonblocking_queue *queue;
+	queue_entry entry;
+	queue_handle handle;
+
+	mm_init(512, sizeof(bucket_node), true);
+	queue = queue_init(16, (pkey_t) 1, 1);
+
+	check_peek(queue, INFTY, "on an empty queue");
+
+	// both beyond the hashtable
+	enqueue(queue, (pkey_t) 40, NULL);
+	enqueue(queue, (pkey_t) 25, NULL);
+	check_peek(queue, (pkey_t) 25, "with the events in the future list");
+	check_peek(queue, (pkey_t) 25, "twice");
+	if(size_estimate(queue) != 2 || dequeue_entry(queue, &entry) != QUEUE_OK || entry.timestamp != (pkey_t) 25)
+	{
+		printf("peek_min removed the minimum\n");
+		errors++;
+	}
+	check_peek(queue, (pkey_t) 40, "after a dequeue");
+
+	// current is past this bucket, thus the enqueue moves it back
+	enqueue(queue, (pkey_t) 5, NULL);
+	check_peek(queue, (pkey_t) 5, "after a late enqueue");
+
+	handle = enqueue_handle(queue, (pkey_t) 1, NULL);
+	check_peek(queue, (pkey_t) 1, "after enqueue_handle");
+	cancel(queue, handle);
+	check_peek(queue, (pkey_t) 5, "after a cancel");
+
+	dequeue_entry(queue, &entry);
+	dequeue_entry(queue, &entry);
+	check_peek(queue, INFTY, "once the queue is empty again");
+
+	printf("peek_min: %s\n", errors == 0 ? "OK" : "FAILED");
+	return errors != 0;
+}
@@ -0,0 +1,114 @@
+/*****************************************************************************
+*
+*	This file is part of NBQueue, a lock-free O(1) priority queue.
+*
+*   Copyright (C) 2015, Romolo Marotta
+*
+*   This program is free software: you can redistribute it and/or modify
+*   it under the terms of the GNU General Public License as published by
+*   the Free Software Foundation, either version 3 of the License, or
+*   (at your option) any later version.
+*
+*   This is distributed in the hope that it will be useful,
+*   but WITHOUT ANY WARRANTY; without even the implied warranty of
+*   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+*   GNU General Public License for more details.
+*
+*   You should have received a copy of the GNU General Public License
+*   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*
+******************************************************************************/
+/*
+ * prune_watermark.c
+ *
+ *  Checks that the buckets before the low watermark of prune can still be reached
+ *  after their segments have been retired and freed: peek_min and cancel_after start
+ *  below it, and a late event below it is still dequeued.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "datatypes/nonblocking_queue.h"
+#include "mm/myallocator.h"
+
+#define EVENTS		400
+#define THRESHOLD	300
+#define PRUNES		4		// calls of prune after which a retired segment has been freed
+
+#if CALENDAR == CALENDAR_LINEAR
+static bool match_all(void *payload, void *arg)
+{
+	(void) payload;
+	(void) arg;
+	return true;
+}
+#endif
+
+int main(void)
+{
+#if CALENDAR == CALENDAR_LINEAR
+	nonblocking_queue *queue;
+	queue_entry entry;
+	unsigned int i, retired = 0, freed = 0, errors = 0;
+
+	mm_init(512, sizeof(bucket_node), true);
+	queue = queue_init(16, (pkey_t) 1, 1);
+
+	for(i = 0; i < EVENTS; i++)
+		enqueue(queue, (pkey_t) i, NULL);
+	for(i = 0; i < THRESHOLD; i++)
+		dequeue_entry(queue, &entry);
+
+	prune(queue, (pkey_t) THRESHOLD);
+	for(i = 0; i < HASHTABLE_SEGMENTS; i++)
+		retired += queue->hashtable[i] == SEGMENT_RETIRED && queue->retiring[i] != NULL;
+	if(retired == 0)
+	{
+		printf("No segment has been retired by prune\n");
+		errors++;
+	}
+
+	// the heads wait for a grace period, which a later call finds elapsed
+	for(i = 0; i < PRUNES; i++)
+		prune(queue, (pkey_t) THRESHOLD);
+	for(i = 0; i < HASHTABLE_SEGMENTS; i++)
+		freed += queue->hashtable[i] == SEGMENT_RETIRED && queue->retiring[i] == NULL;
+	if(freed == 0)
+	{
+		printf("No retired segment has been freed by prune\n");
+		errors++;
+	}
+
+	if(peek_min(queue) != (pkey_t) THRESHOLD)
+	{
+		printf("peek_min returned %f instead of %d\n", (double) peek_min(queue), THRESHOLD);
+		errors++;
+	}
+
+	// an event below the watermark lands in the first bucket after it
+	enqueue(queue, (pkey_t) 1, NULL);
+	if(dequeue_entry(queue, &entry) != QUEUE_OK || entry.timestamp != (pkey_t) 1)
+	{
+		printf("The late event has not been dequeued first\n");
+		errors++;
+	}
+
+	if(cancel_after(queue, (pkey_t) 0, match_all, NULL) != EVENTS - THRESHOLD)
+	{
+		printf("cancel_after missed some events\n");
+		errors++;
+	}
+	if(peek_min(queue) != INFTY || dequeue_entry(queue, &entry) != QUEUE_EMPTY)
+	{
+		printf("The queue is not empty after cancel_after\n");
+		errors++;
+	}
+
+	printf("prune_watermark: %s\n", errors == 0 ? "OK" : "FAILED");
+	return errors != 0;
+#else
+	printf("prune_watermark: skipped, the ring retires no segment\n");
+	return 0;
+#endif
+}
@@ -0,0 +1,124 @@
+/*****************************************************************************
+*
+*	This file is part of NBQueue, a lock-free O(1) priority queue.
+*
+*   Copyright (C) 2015, Romolo Marotta
+*
+*   This program is free software: you can redistribute it and/or modify
+*   it under the terms of the GNU General Public License as published by
+*   the Free Software Foundation, either version 3 of the License, or
+*   (at your option) any later version.
+*
+*   This is distributed in the hope that it will be useful,
+*   but WITHOUT ANY WARRANTY; without even the implied warranty of
+*   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+*   GNU General Public License for more details.
+*
+*   You should have received a copy of the GNU General Public License
+*   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*
+******************************************************************************/
+/*
+ * reschedule.c
+ *
+ *  Checks that reschedule moves each pending event once, leaves the number of events
+ *  unchanged, and refuses stale handles and events linked by enqueue_node.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "datatypes/nonblocking_queue.h"
+#include "mm/myallocator.h"
+
+#define EVENTS		100
+#define LATER		1000
+
+typedef struct event event;
+struct event
+{
+	bucket_node node;
+	unsigned int id;
+};
+
+static void release(void *node)
+{
+	(void) node;
+}
+
+int main(void)
+{
+	nonblocking_queue *queue;
+	queue_handle handles[EVENTS], moved;
+	queue_entry entry;
+	event intrusive;
+	unsigned int i, dequeued = 0, errors = 0;
+	pkey_t last = 0;
+
+	mm_init(512, sizeof(bucket_node), true);
+	queue = queue_init(16, (pkey_t) 1, 1);
+	queue_set_release(queue, release);
+
+	for(i = 0; i < EVENTS; i++)
+		handles[i] = enqueue_handle(queue, (pkey_t) (2*i), NULL);
+
+	// the even events are moved after all the others
+	for(i = 0; i < EVENTS; i += 2)
+	{
+		moved = reschedule(queue, handles[i], (pkey_t) (LATER + i));
+		if(moved.node == NULL)
+		{
+			printf("A pending event has not been rescheduled\n");
+			errors++;
+		}
+		if(reschedule(queue, handles[i], (pkey_t) 0).node != NULL)
+		{
+			printf("A stale handle has been rescheduled\n");
+			errors++;
+		}
+		handles[i] = moved;
+	}
+	if(size_estimate(queue) != EVENTS)
+	{
+		printf("size_estimate is %llu instead of %d\n", size_estimate(queue), EVENTS);
+		errors++;
+	}
+
+	// an event in a node of the caller cannot be moved
+	enqueue_node(queue, &intrusive.node, (pkey_t) (LATER + EVENTS), NULL);
+	if(reschedule(queue, node_handle(&intrusive.node), (pkey_t) 1).node != NULL)
+	{
+		printf("An event linked by enqueue_node has been rescheduled\n");
+		errors++;
+	}
+
+	while(dequeue_entry(queue, &entry) == QUEUE_OK)
+	{
+		if(entry.timestamp < last)
+		{
+			printf("Event %f dequeued after %f\n", (double) entry.timestamp, (double) last);
+			errors++;
+		}
+		// the odd events first, then the moved ones, then the intrusive one
+		if(dequeued < EVENTS/2 ? entry.timestamp >= LATER : entry.timestamp < LATER)
+		{
+			printf("Event %f dequeued in position %u\n", (double) entry.timestamp, dequeued);
+			errors++;
+		}
+		last = entry.timestamp;
+		dequeued++;
+	}
+	if(dequeued != EVENTS + 1)
+	{
+		printf("%u events dequeued instead of %d\n", dequeued, EVENTS + 1);
+		errors++;
+	}
+	if(reschedule(queue, handles[0], (pkey_t) 0).node != NULL)
+	{
+		printf("A dequeued event has been rescheduled\n");
+		errors++;
+	}
+
+	printf("reschedule: %s\n", errors == 0 ? "OK" : "FAILED");
+	return errors != 0;
+}